@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <boost/endian/conversion.hpp>
+#include <opencv2/core.hpp>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/MappedFile.hpp"
+
+namespace cvqoi
+{
+    // Many QOI images in one file, for data sets where opening a file per image dominates.
+    //
+    // Layout: QOI stream[count], entry[count], entries offset(u64), count(u64), MAGIC
+    // Entry: offset(u64), size(u64), width(u32), height(u32), channels(u8), 7 reserved bytes
+    //
+    // Entries have a fixed size and the footer is at the end of the file, so finding image i is O(1).
+    namespace archive {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'a'};
+        constexpr size_t ENTRY_SIZE = 32;
+        constexpr size_t FOOTER_SIZE = 8 + 8 + MAGIC.size();
+
+        struct Entry {
+            uint64_t offset;
+            uint64_t size;
+            uint32_t width;
+            uint32_t height;
+            uint8_t channels;
+        };
+    }
+
+    // Appends Encoder output to an archive. finish() must be called once all images are added.
+    class ArchiveBuilder
+    {
+        // Forwards to the archive stream and counts, std::ostream::tellp does not work on every stream.
+        class CountingBuf : public std::streambuf {
+        public:
+            explicit CountingBuf(std::streambuf *target) : target(target) {}
+            uint64_t count{0};
+        protected:
+            std::streamsize xsputn(const char *s, std::streamsize n) override {
+                auto written = target->sputn(s, n);
+                count += written;
+                return written;
+            }
+            int_type overflow(int_type ch) override {
+                if (traits_type::eq_int_type(ch, traits_type::eof())) {
+                    return traits_type::not_eof(ch);
+                }
+                auto res = target->sputc(traits_type::to_char_type(ch));
+                if (!traits_type::eq_int_type(res, traits_type::eof())) {
+                    ++count;
+                }
+                return res;
+            }
+            int sync() override {
+                return target->pubsync();
+            }
+        private:
+            std::streambuf *target;
+        };
+
+    public:
+        explicit ArchiveBuilder(std::ostream &os) : buf(os.rdbuf()), os(&buf) {}
+
+        template<bool hasAlpha>
+        size_t append(const Encoder<hasAlpha> &e) {
+            auto h = e.info();
+            archive::Entry entry{buf.count, 0, h.width, h.height, h.channels};
+            os << e;
+            entry.size = buf.count - entry.offset;
+            if (!os) {
+                throw std::runtime_error("Could not write to the archive");
+            }
+            entries.push_back(entry);
+            return entries.size() - 1;
+        }
+
+        size_t append(const cv::Mat &mat) {
+            if (mat.channels() == 4) {
+                return append(Encoder<true>(mat));
+            }
+            return append(Encoder<>(mat));
+        }
+
+        void finish() {
+            auto tableOffset = buf.count;
+            for (const auto &e : entries) {
+                std::array<uint8_t, archive::ENTRY_SIZE> raw{};
+                boost::endian::store_big_u64(raw.data(), e.offset);
+                boost::endian::store_big_u64(raw.data() + 8, e.size);
+                boost::endian::store_big_u32(raw.data() + 16, e.width);
+                boost::endian::store_big_u32(raw.data() + 20, e.height);
+                raw[24] = e.channels;
+                os.write(reinterpret_cast<const char*>(raw.data()), raw.size());
+            }
+            std::array<uint8_t, archive::FOOTER_SIZE> footer{};
+            boost::endian::store_big_u64(footer.data(), tableOffset);
+            boost::endian::store_big_u64(footer.data() + 8, entries.size());
+            std::copy(archive::MAGIC.begin(), archive::MAGIC.end(), footer.begin() + 16);
+            os.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+            os.flush();
+            if (!os) {
+                throw std::runtime_error("Could not write to the archive");
+            }
+        }
+
+        size_t size() const {
+            return entries.size();
+        }
+
+    private:
+        CountingBuf buf;
+        std::ostream os;
+        std::vector<archive::Entry> entries;
+    };
+
+    // Maps an archive and decodes single images straight out of the mapping (POSIX only).
+    class ArchiveReader
+    {
+    public:
+        explicit ArchiveReader(const std::string &path) : file(path) {
+            auto *data = file.data();
+            auto size = file.size();
+            if (size < archive::FOOTER_SIZE 
+                || !std::equal(archive::MAGIC.begin(), archive::MAGIC.end(), data + size - archive::MAGIC.size())) {
+                throw std::runtime_error(path + " is not a cvqoi archive");
+            }
+            auto *footer = data + size - archive::FOOTER_SIZE;
+            auto tableOffset = boost::endian::load_big_u64(footer);
+            count = boost::endian::load_big_u64(footer + 8);
+            if (tableOffset > size - archive::FOOTER_SIZE 
+                || (size - archive::FOOTER_SIZE - tableOffset) / archive::ENTRY_SIZE < count) {
+                throw std::runtime_error(path + " has a corrupt entry table");
+            }
+            table = data + tableOffset;
+            // Training loaders jump around, sequential read-ahead would only pull in unused images.
+            file.advise(0, size, MADV_RANDOM);
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        archive::Entry entry(size_t i) const {
+            if (i >= count) {
+                throw std::out_of_range("Archive entry index is out of range");
+            }
+            auto *raw = table + i * archive::ENTRY_SIZE;
+            archive::Entry e{boost::endian::load_big_u64(raw), boost::endian::load_big_u64(raw + 8),
+                             boost::endian::load_big_u32(raw + 16), boost::endian::load_big_u32(raw + 20), raw[24]};
+            if (e.offset > file.size() || file.size() - e.offset < e.size) {
+                throw std::runtime_error("Archive entry points outside of the file");
+            }
+            return e;
+        }
+
+        // The encoded QOI stream of image i, pointing into the mapping.
+        std::pair<const uint8_t*, size_t> data(size_t i) const {
+            auto e = entry(i);
+            return {file.data() + e.offset, static_cast<size_t>(e.size)};
+        }
+
+        void decode(size_t i, cv::Mat &mat) const {
+            auto d = data(i);
+            Decoder::decode(d.first, d.second, mat);
+        }
+
+    private:
+        MappedFile file;
+        const uint8_t *table{nullptr};
+        uint64_t count{0};
+    };
+};
@@ -0,0 +1,373 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "cvqoi/BoundedQueue.hpp"
+#include "cvqoi/Trace.hpp"
+
+// Linux only, kept out of CVQoi.hpp so the core header stays portable.
+
+namespace cvqoi
+{
+    // Writes many small files from a background thread so encoding and I/O overlap. Queued files
+    // are submitted in batches through io_uring, each as a linked open, write and close, so a batch
+    // of n files costs one syscall instead of 3n. Without a usable io_uring (old kernel, seccomp,
+    // containers) it falls back to open, pwritev and close.
+    //
+    //     cvqoi::BatchWriter writer;
+    //     writer.write("0001.qoi", std::move(encoded));
+    //     writer.flush();    //Waits for everything queued so far, throws if a file failed
+    class BatchWriter
+    {
+    public:
+        enum class Backend { Auto, IoUring, Pwritev };
+
+        explicit BatchWriter(uint32_t batchSize = 64, Backend backend = Backend::Auto) 
+            : batchSize(batchSize ? batchSize : 1), queue(2 * this->batchSize) {
+            if (backend != Backend::Pwritev) {
+                try {
+                    ring.setup(this->batchSize);
+                    used = Backend::IoUring;
+                }
+                catch (const std::system_error&) {
+                    if (backend == Backend::IoUring) {
+                        throw;
+                    }
+                    used = Backend::Pwritev;
+                }
+            }
+            else {
+                used = Backend::Pwritev;
+            }
+            worker = std::thread([this] { run(); });
+        }
+
+        BatchWriter(const BatchWriter&) = delete;
+        BatchWriter& operator=(const BatchWriter&) = delete;
+
+        ~BatchWriter() {
+            queue.close();
+            worker.join();
+        }
+
+        // Blocks only while 2 * batchSize files are already waiting.
+        void write(std::string path, std::vector<char> bytes) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++queued;
+            }
+            queue.push(Item{std::move(path), std::move(bytes)});
+        }
+
+        // Waits until every file queued so far is closed. Throws for the first failure since the last flush.
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return completed == queued; });
+            if (!errors.empty()) {
+                auto msg = std::move(errors.front());
+                errors.clear();
+                throw std::runtime_error(msg);
+            }
+        }
+
+        Backend backend() const {
+            return used;
+        }
+
+    private:
+        struct Item {
+            std::string path;
+            std::vector<char> bytes;
+        };
+
+        // Minimal io_uring driven through the raw syscalls so there is no liburing dependency.
+        class Ring {
+        public:
+            Ring() = default;
+            Ring(const Ring&) = delete;
+            Ring& operator=(const Ring&) = delete;
+
+            ~Ring() {
+                if (sqes) {
+                    ::munmap(sqes, sqesSize);
+                }
+                if (cqPtr && cqPtr != sqPtr) {
+                    ::munmap(cqPtr, cqSize);
+                }
+                if (sqPtr) {
+                    ::munmap(sqPtr, sqSize);
+                }
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+            }
+
+            void setup(uint32_t files) {
+                io_uring_params p{};
+                fd = static_cast<int>(::syscall(__NR_io_uring_setup, files * 3, &p));
+                if (fd < 0) {
+                    throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+                }
+                sqSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+                cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+                if (single) {
+                    sqSize = cqSize = std::max(sqSize, cqSize);
+                }
+                sqPtr = map(sqSize, IORING_OFF_SQ_RING);
+                cqPtr = single ? sqPtr : map(cqSize, IORING_OFF_CQ_RING);
+                sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+                sqes = static_cast<io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+
+                auto *sq = static_cast<uint8_t*>(sqPtr);
+                sqTail = reinterpret_cast<std::atomic<uint32_t>*>(sq + p.sq_off.tail);
+                sqMask = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+                sqArray = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+                auto *cq = static_cast<uint8_t*>(cqPtr);
+                cqHead = reinterpret_cast<std::atomic<uint32_t>*>(cq + p.cq_off.head);
+                cqTail = reinterpret_cast<std::atomic<uint32_t>*>(cq + p.cq_off.tail);
+                cqMask = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+                cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+                // One direct descriptor slot per file of a batch, the open writes into it and the
+                // linked write and close use it, no fd ever goes back to user space.
+                std::vector<int> empty(files, -1);
+                if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, empty.data(), files) < 0) {
+                    throw std::system_error(errno, std::generic_category(), "io_uring_register");
+                }
+            }
+
+            io_uring_sqe& next() {
+                auto tail = sqTail->load(std::memory_order_relaxed) + pending;
+                auto idx = tail & sqMask;
+                sqArray[idx] = idx;
+                ++pending;
+                auto &sqe = sqes[idx];
+                std::memset(&sqe, 0, sizeof(sqe));
+                return sqe;
+            }
+
+            // Submits everything prepared with next() and waits for waitFor completions.
+            void submit(uint32_t waitFor) {
+                sqTail->store(sqTail->load(std::memory_order_relaxed) + pending, std::memory_order_release);
+                auto toSubmit = pending;
+                pending = 0;
+                do {
+                    auto res = ::syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    if (res < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+                    }
+                    toSubmit -= static_cast<uint32_t>(res);
+                } while (toSubmit > 0);
+            }
+
+            template<typename F>
+            uint32_t reap(F f) {
+                uint32_t n = 0;
+                auto head = cqHead->load(std::memory_order_relaxed);
+                while (head != cqTail->load(std::memory_order_acquire)) {
+                    auto &cqe = cqes[head & cqMask];
+                    f(cqe.user_data, cqe.res);
+                    ++head;
+                    ++n;
+                }
+                cqHead->store(head, std::memory_order_release);
+                return n;
+            }
+
+        private:
+            void* map(size_t size, off_t offset) {
+                void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+                if (p == MAP_FAILED) {
+                    throw std::system_error(errno, std::generic_category(), "io_uring mmap");
+                }
+                return p;
+            }
+
+            int fd{-1};
+            void *sqPtr{nullptr};
+            void *cqPtr{nullptr};
+            io_uring_sqe *sqes{nullptr};
+            size_t sqSize{0}, cqSize{0}, sqesSize{0};
+            std::atomic<uint32_t> *sqTail{nullptr};
+            uint32_t sqMask{0};
+            uint32_t *sqArray{nullptr};
+            std::atomic<uint32_t> *cqHead{nullptr};
+            std::atomic<uint32_t> *cqTail{nullptr};
+            uint32_t cqMask{0};
+            io_uring_cqe *cqes{nullptr};
+            uint32_t pending{0};
+        };
+
+        static constexpr int FILE_MODE = 0644;
+        static constexpr int OPEN_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        void run() {
+            std::vector<Item> batch;
+            Item item;
+            while (queue.pop(item)) {
+                batch.push_back(std::move(item));
+                while (batch.size() < batchSize && queue.tryPop(item)) {
+                    batch.push_back(std::move(item));
+                }
+                CVQOI_TRACE_SPAN("writeBatch");
+                std::vector<std::string> failures;
+                if (used == Backend::IoUring) {
+                    writeIoUring(batch, failures);
+                }
+                else {
+                    for (auto &i : batch) {
+                        writePwritev(i, failures);
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    completed += batch.size();
+                    errors.insert(errors.end(), failures.begin(), failures.end());
+                }
+                done.notify_all();
+                batch.clear();
+            }
+        }
+
+        void writeIoUring(std::vector<Item> &batch, std::vector<std::string> &failures) {
+            enum Op : uint64_t { Open, Write, Close };
+            std::vector<int> openRes(batch.size(), 0), writeRes(batch.size(), 0);
+            for (uint32_t k = 0; k < batch.size(); ++k) {
+                auto &i = batch[k];
+                // Completions carry the written size as an int.
+                if (i.bytes.size() > INT_MAX) {
+                    writePwritev(i, failures);
+                    continue;
+                }
+                auto &open = ring.next();
+                open.opcode = IORING_OP_OPENAT;
+                open.fd = AT_FDCWD;
+                open.addr = reinterpret_cast<uint64_t>(i.path.c_str());
+                open.len = FILE_MODE;
+                // Direct descriptors are never inherited, the kernel rejects O_CLOEXEC for them.
+                open.open_flags = OPEN_FLAGS & ~O_CLOEXEC;
+                open.file_index = k + 1;
+                open.flags = IOSQE_IO_LINK;
+                open.user_data = k * 3 + Open;
+
+                auto &write = ring.next();
+                write.opcode = IORING_OP_WRITE;
+                write.fd = static_cast<int>(k);
+                write.flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+                write.addr = reinterpret_cast<uint64_t>(i.bytes.data());
+                write.len = static_cast<uint32_t>(i.bytes.size());
+                write.off = 0;
+                write.user_data = k * 3 + Write;
+
+                auto &close = ring.next();
+                close.opcode = IORING_OP_CLOSE;
+                close.file_index = k + 1;
+                close.user_data = k * 3 + Close;
+                ++inFlight;
+            }
+            ring.submit(inFlight * 3);
+            // Submission may return before every completion is posted, keep reaping until all are in.
+            uint32_t expected = inFlight * 3, seen = 0;
+            while (seen < expected) {
+                seen += ring.reap([&](uint64_t userData, int res) {
+                    auto k = userData / 3;
+                    if (userData % 3 == Open) {
+                        openRes[k] = res;
+                    }
+                    else if (userData % 3 == Write) {
+                        writeRes[k] = res;
+                    }
+                });
+                if (seen < expected) {
+                    ring.submit(1);
+                }
+            }
+            inFlight = 0;
+            for (uint32_t k = 0; k < batch.size(); ++k) {
+                auto &i = batch[k];
+                if (i.bytes.size() > INT_MAX) {
+                    continue;
+                }
+                if (openRes[k] == -EINVAL) {
+                    // Kernels before 5.15 can not open into a direct descriptor, finish with the fallback.
+                    used = Backend::Pwritev;
+                    writePwritev(i, failures);
+                }
+                else if (openRes[k] < 0) {
+                    failures.push_back("Could not open " + i.path + ": " + std::strerror(-openRes[k]));
+                }
+                else if (writeRes[k] == -EBADF || writeRes[k] == -ECANCELED) {
+                    // Before 5.18 the open succeeds, but the linked write looks up the slot when it is
+                    // submitted, before the open ran, and the close is cancelled with it.
+                    used = Backend::Pwritev;
+                    writePwritev(i, failures);
+                }
+                else if (writeRes[k] < 0) {
+                    failures.push_back("Could not write " + i.path + ": " + std::strerror(-writeRes[k]));
+                }
+                else if (static_cast<int64_t>(writeRes[k]) < static_cast<int64_t>(i.bytes.size())) {
+                    // A single write stops short of 2 GiB, the rest continues where it ended.
+                    writePwritev(i, failures, static_cast<size_t>(writeRes[k]));
+                }
+            }
+        }
+
+        // A non-zero from continues a file that is already written up to there.
+        static void writePwritev(Item &i, std::vector<std::string> &failures, size_t from = 0) {
+            int fd = ::open(i.path.c_str(), from ? O_WRONLY | O_CLOEXEC : OPEN_FLAGS, FILE_MODE);
+            if (fd < 0) {
+                failures.push_back("Could not open " + i.path + ": " + std::strerror(errno));
+                return;
+            }
+            iovec iov{i.bytes.data() + from, i.bytes.size() - from};
+            auto offset = static_cast<off_t>(from);
+            while (iov.iov_len > 0) {
+                auto n = ::pwritev(fd, &iov, 1, offset);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    failures.push_back("Could not write " + i.path + ": " + std::strerror(errno));
+                    break;
+                }
+                iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+                iov.iov_len -= static_cast<size_t>(n);
+                offset += n;
+            }
+            ::close(fd);
+        }
+
+        uint32_t batchSize;
+        BoundedQueue<Item> queue;
+        Ring ring;
+        std::atomic<Backend> used{Backend::Auto};
+        uint32_t inFlight{0};
+        std::thread worker;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t queued{0};
+        size_t completed{0};
+        std::vector<std::string> errors;
+    };
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace cvqoi
+{
+    // Blocking multi-producer multi-consumer queue with a fixed capacity, used to connect
+    // pipeline stages so a fast stage cannot run ahead and buffer unbounded data.
+    template<typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+        // Blocks while full. Returns false if the queue was closed.
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+            if (closed) {
+                return false;
+            }
+            items.push_back(std::move(item));
+            lock.unlock();
+            notEmpty.notify_one();
+            return true;
+        }
+
+        // Blocks while empty. Returns false once the queue is closed and drained.
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty()) {
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+            lock.unlock();
+            notFull.notify_one();
+            return true;
+        }
+
+        // Like pop but returns false right away when the queue is empty.
+        bool tryPop(T &item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (items.empty()) {
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+            lock.unlock();
+            notFull.notify_one();
+            return true;
+        }
+
+        // Wakes everyone, pushes fail from now on and pops fail once the queue is drained.
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            notFull.notify_all();
+            notEmpty.notify_all();
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return items.size();
+        }
+
+    private:
+        size_t capacity;
+        std::deque<T> items;
+        bool closed{false};
+        mutable std::mutex mutex;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+    };
+};
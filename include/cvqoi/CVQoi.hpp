@@ -1,23 +1,43 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <boost/endian/conversion.hpp>
 #include <boost/endian/detail/order.hpp>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <opencv2/core.hpp>
 #include <opencv2/core/mat.hpp>
 #include <opencv2/core/matx.hpp>
 #include <opencv2/core/types.hpp>
+#include <istream>
+#include <iterator>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
 #include <stdint.h>
+#include <streambuf>
+#include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <boost/endian.hpp>
 #include <boost/endian/buffers.hpp>
+#include "cvqoi/Trace.hpp"
 
 //#define CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
 
+// MSVC has no __SSE4_2__, /arch:AVX and up imply it.
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(__AVX__))
+#define CVQOI_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
 #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
 #include <boost/optional.hpp>
 #endif
@@ -32,6 +52,79 @@ namespace cvqoi
     namespace qoi {
         constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'f'};
         constexpr std::array<char, 8> EOS{0, 0, 0, 0, 0, 0, 0, 1};
+        constexpr size_t HEADER_SIZE = 14;
+        // Largest image the reference decoder accepts, anything above is treated as corrupt.
+        constexpr uint64_t PIXELS_MAX = 400000000;
+    }
+
+    // Lossless transforms applied to the pixels before opcode selection and undone after decoding.
+    enum class Filter : uint8_t {
+        None = 0,
+        YCoCgR = 1,    // Per pixel decorrelation, Y goes in green where luma chunks expect the large delta.
+        Vertical = 2   // Every pixel minus the one above it.
+    };
+
+    // Orientation changes applied while reading the source, same results as cv::rotate, cv::flip
+    // and cv::transpose without the transformed copy.
+    enum class Transform {
+        None,
+        Rotate90,       // Clockwise, cv::ROTATE_90_CLOCKWISE.
+        Rotate180,
+        Rotate270,      // Counterclockwise, cv::ROTATE_90_COUNTERCLOCKWISE.
+        FlipHorizontal, // Left and right mirrored, cv::flip(src, dst, 1).
+        FlipVertical,   // Upside down, cv::flip(src, dst, 0).
+        Transpose
+    };
+
+    // Non-standard features are signalled by a small header in front of the QOI stream. Streams
+    // that use none of them are written without it and stay plain QOI.
+    //
+    // Layout: MAGIC, version(u8), filter(u8), flags(u8), reserved(u8)
+    // With flags::DICTIONARY it is followed by the dictionary id(u32).
+    namespace container {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'c'};
+        constexpr uint8_t VERSION = 1;
+        constexpr size_t HEADER_SIZE = 8;
+        namespace flags {
+            constexpr uint8_t LARGE_INDEX = 1 << 0;
+            constexpr uint8_t DICTIONARY = 1 << 1;
+            constexpr uint8_t INTERLACED = 1 << 2;
+            constexpr uint8_t WIDE = 1 << 3;
+            constexpr uint8_t KNOWN = LARGE_INDEX | DICTIONARY | INTERLACED | WIDE;
+        }
+    }
+
+    // YCoCg-R with every lifting step done modulo 256, each step is still exactly invertible
+    // so the transform stays lossless in 8 bits. Stored as blue = Cg, green = Y, red = Co.
+    namespace ycocg {
+        inline void forward(uint8_t &b, uint8_t &g, uint8_t &r) {
+            uint8_t co = r - b;
+            uint8_t t = b + (static_cast<int8_t>(co) >> 1);
+            uint8_t cg = g - t;
+            g = t + (static_cast<int8_t>(cg) >> 1);
+            b = cg;
+            r = co;
+        }
+
+        inline void inverse(uint8_t &b, uint8_t &g, uint8_t &r) {
+            uint8_t t = g - (static_cast<int8_t>(b) >> 1);
+            g = b + t;
+            b = t - (static_cast<int8_t>(r) >> 1);
+            r = b + r;
+        }
+    }
+
+    // Optional trailer written after qoi::EOS. Every interval rows it stores where the next opcode
+    // starts and the decoder state at that point, so a band of rows can be decoded without
+    // starting from the first pixel. Decoders that follow the spec stop at EOS and never see it.
+    //
+    // Layout: checkpoint[count], interval(u32), count(u32), MAGIC
+    // Checkpoint k is for row (k + 1) * interval:
+    // offset(u64), pending run(u8), previous pixel(RGBA), index table(64 * RGBA)
+    namespace rowindex {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'x'};
+        constexpr size_t CHECKPOINT_SIZE = 8 + 1 + 4 + 64 * 4;
+        constexpr size_t FOOTER_SIZE = 4 + 4 + MAGIC.size();
     }
 
     namespace luma {
@@ -80,6 +173,136 @@ namespace cvqoi
         using chunk = uint8_t;
     }
 
+    // Extended profile: a second color cache of SIZE entries next to the 64 entry one, for images
+    // with more recurring colors than that. Its 2-byte chunk takes the 8 longest run codes, the
+    // first byte holds the high 3 bits of the slot, so runs are limited to RUN_UPPER_LIMIT.
+    namespace largeindex {
+        constexpr uint8_t TAG = 0xf6;
+        constexpr int BITS = 11;
+        constexpr size_t SIZE = 1 << BITS;
+        constexpr uint8_t RUN_UPPER_LIMIT = TAG - run::TAG;
+        using chunk = std::array<uint8_t, 2>;
+    }
+
+    // Interlaced streams hold the pixels pass by pass in Adam7 order. Until later passes arrive
+    // every pixel of a pass stands for the block of blockWidth x blockHeight pixels it starts.
+    namespace adam7 {
+        struct Pass {
+            uint32_t x0, y0, dx, dy, blockWidth, blockHeight;
+        };
+        constexpr std::array<Pass, 7> PASSES{{{0, 0, 8, 8, 8, 8}, {4, 0, 8, 8, 4, 8}, {0, 4, 4, 8, 4, 4}, 
+                                              {2, 0, 4, 4, 2, 4}, {0, 2, 2, 4, 2, 2}, {1, 0, 2, 2, 1, 2}, 
+                                              {0, 1, 1, 2, 1, 1}}};
+
+        // Pixels of a pass along a side of length n.
+        constexpr uint32_t count(uint32_t n, uint32_t start, uint32_t step) {
+            return n > start ? (n - start + step - 1) / step : 0;
+        }
+    }
+
+    // 16-bit images, see WideEncoder. The samples are split into a high and a low byte plane and
+    // each plane is a QOI stream of its own. Planes with 1 or 2 channels are packed 3 bytes to an
+    // RGB pixel, rows padded with their last byte.
+    //
+    // Layout after a container header with flags::WIDE:
+    // channels(u8), reserved(3), width(u32), height(u32), high plane size(u64), high plane, low plane
+    namespace wide {
+        constexpr size_t HEADER_SIZE = 4 + 4 + 4 + 8;
+
+        // Width in pixels and channel count of the QOI image a plane is stored as.
+        inline std::pair<uint32_t, int> planeShape(uint32_t width, int channels) {
+            if (channels >= 3) {
+                return {width, channels};
+            }
+            return {(width * channels + 2) / 3, 3};
+        }
+    }
+
+    // Serialized Dictionary. Layout: MAGIC, id(u32), previous pixel(RGBA), index table(64 * RGBA)
+    namespace dictionary {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'd'};
+        constexpr size_t SIZE = 4 + 4 + 4 + 64 * 4;
+    }
+
+    // Optional trailer written last, after qoi::EOS and the row index if there is one. Holds the
+    // CRC32C of every byte before it, so files can be checked without decoding them.
+    //
+    // Layout: crc(u32), MAGIC
+    namespace checksum {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'k'};
+        constexpr size_t TRAILER_SIZE = 4 + MAGIC.size();
+    }
+
+    // CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the compiler targets it,
+    // slice-by-8 tables otherwise. Chainable, update(update(0, a), b) is the CRC of a followed by b.
+    namespace crc32c {
+        constexpr uint32_t POLY = 0x82f63b78; // Reflected.
+
+        using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+        constexpr Tables makeTables() {
+            Tables t{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c >> 1) ^ ((c & 1) ? POLY : 0);
+                }
+                t[0][i] = c;
+            }
+            for (size_t k = 1; k < t.size(); ++k) {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+                }
+            }
+            return t;
+        }
+
+        inline constexpr Tables TABLES = makeTables();
+
+        inline uint32_t update(uint32_t crc, const uint8_t *p, size_t n) {
+            crc = ~crc;
+#ifdef CVQOI_CRC32C_SSE42
+#if defined(__x86_64__) || defined(_M_X64)
+            uint64_t c = crc;
+            for (; n >= 8; n -= 8, p += 8) {
+                uint64_t v;
+                std::memcpy(&v, p, sizeof(v));
+                c = _mm_crc32_u64(c, v);
+            }
+            crc = static_cast<uint32_t>(c);
+#else
+            for (; n >= 4; n -= 4, p += 4) {
+                uint32_t v;
+                std::memcpy(&v, p, sizeof(v));
+                crc = _mm_crc32_u32(crc, v);
+            }
+#endif
+            for (; n > 0; --n) {
+                crc = _mm_crc32_u8(crc, *p++);
+            }
+#else
+            const auto &t = TABLES;
+            for (; n >= 8; n -= 8, p += 8) {
+                uint32_t lo = boost::endian::load_little_u32(p) ^ crc;
+                uint32_t hi = boost::endian::load_little_u32(p + 4);
+                crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                    ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+            }
+            for (; n > 0; --n) {
+                crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+            }
+#endif
+            return ~crc;
+        }
+    }
+
+    // Result of Decoder::verify.
+    enum class Integrity {
+        Unchecked,  // No checksum trailer.
+        Valid,
+        Corrupt
+    };
+
     template<typename Pixel,
              typename SignedPixel,
              bool hasAlpha = false>
@@ -143,12 +366,26 @@ namespace cvqoi
 
         static int hash(const Pixel &p) {
             int val =  (blue(p) * 7) + (green(p) * 5) + (red(p) * 3);
-            if (hasAlpha) {
+            if constexpr (hasAlpha) {
                 val += alpha(p) * 11;
             }
+            else {
+                // Pixels without alpha are hashed as opaque, same as the reference implementation.
+                val += 255 * 11;
+            }
             return val % 64;
         }
 
+        // Slot in the largeindex cache, a multiplicative hash of the packed RGBA value.
+        static uint32_t largeHash(const Pixel &p) {
+            uint32_t a = 255;
+            if constexpr (hasAlpha) {
+                a = alpha(p);
+            }
+            uint32_t v = red(p) | (green(p) << 8) | (blue(p) << 16) | (a << 24);
+            return (v * 2654435761u) >> (32 - largeindex::BITS);
+        }
+
         template<typename T>
         struct is_std_array : std::false_type {};
 
@@ -170,152 +407,999 @@ namespace cvqoi
         }
     };
 
+    struct Header {
+        uint32_t width;
+        uint32_t height;
+        uint8_t channels;
+        uint8_t colorspace;
+    };
+
+    // Starting state of the index table and previous pixel, trained on a corpus of small images so
+    // their first occurrences of common colors become index chunks or runs instead of full rgb/rgba
+    // chunks. Streams reference it by id, decoders find it among the registered ones. BGRA like the
+    // decoded pixels.
+    struct Dictionary {
+        using Pixel = PixelType<true>;
+
+        uint32_t id{0};
+        std::array<Pixel, 64> index{};
+        Pixel previous{0, 0, 0, 255};
+
+        // Fills every slot with the color of that hash found in the most images, and previous with
+        // the most common top left pixel.
+        static Dictionary train(uint32_t id, const std::vector<cv::Mat> &corpus) {
+            using util = cvqoi::util<Pixel, SignedPixelType<true>, true>;
+            std::unordered_map<uint32_t, uint32_t> images, firsts;
+            for (const auto &img : corpus) {
+                assert(img.depth() == CV_8U && (img.channels() == 3 || img.channels() == 4)
+                       && "Dictionaries are trained on 8-bit images with 3 or 4 channels.");
+                auto channels = img.channels();
+                std::unordered_set<uint32_t> seen;
+                for (int r = 0; r < img.rows; ++r) {
+                    auto *row = img.ptr<uint8_t>(r);
+                    for (int c = 0; c < img.cols; ++c) {
+                        seen.insert(pack(row + c * channels, channels));
+                    }
+                }
+                for (auto v : seen) {
+                    ++images[v];
+                }
+                if (!img.empty()) {
+                    ++firsts[pack(img.ptr<uint8_t>(0), channels)];
+                }
+            }
+            // Ties go to the larger packed value so the result does not depend on hash map order.
+            auto pick = [](const std::unordered_map<uint32_t, uint32_t> &counts, auto &&slotOf, auto &&take) {
+                std::array<std::pair<uint32_t, uint32_t>, 64> best{};
+                for (const auto &[v, n] : counts) {
+                    auto &b = best[slotOf(v)];
+                    if (std::make_pair(n, v) > b) {
+                        b = {n, v};
+                        take(v);
+                    }
+                }
+            };
+            Dictionary d;
+            d.id = id;
+            pick(images, [](uint32_t v) { return util::hash(unpack(v)); },
+                 [&d](uint32_t v) { d.index[util::hash(unpack(v))] = unpack(v); });
+            pick(firsts, [](uint32_t) { return 0; }, [&d](uint32_t v) { d.previous = unpack(v); });
+            return d;
+        }
+
+        // Makes d available to decoders. Ids can not be reused for a different dictionary,
+        // streams would silently decode to something else.
+        static void add(const Dictionary &d) {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            auto inserted = registry().emplace(d.id, d);
+            if (!inserted.second && !(inserted.first->second == d)) {
+                throw std::logic_error("A different dictionary with id " + std::to_string(d.id) + " is already registered");
+            }
+        }
+
+        // Registered dictionaries are never removed, the pointer stays valid.
+        static const Dictionary* find(uint32_t id) {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            auto it = registry().find(id);
+            return it == registry().end() ? nullptr : &it->second;
+        }
+
+        void write(std::ostream &os) const {
+            using util = cvqoi::util<Pixel, SignedPixelType<true>, true>;
+            util::writeArrayToStream(dictionary::MAGIC, os);
+            util::writeToStream(id, os);
+            util::writeArrayToStream(toRGBA(previous), os);
+            for (const auto &p : index) {
+                util::writeArrayToStream(toRGBA(p), os);
+            }
+        }
+
+        static Dictionary read(std::istream &is) {
+            std::array<uint8_t, dictionary::SIZE> buf;
+            if (!is.read(reinterpret_cast<char*>(buf.data()), buf.size())
+                || !std::equal(dictionary::MAGIC.begin(), dictionary::MAGIC.end(), buf.begin())) {
+                throw std::runtime_error("Not a cvqoi dictionary");
+            }
+            Dictionary d;
+            d.id = boost::endian::load_big_u32(buf.data() + 4);
+            d.previous = fromRGBA(buf.data() + 8);
+            for (size_t i = 0; i < d.index.size(); ++i) {
+                d.index[i] = fromRGBA(buf.data() + 12 + i * 4);
+            }
+            return d;
+        }
+
+        bool operator==(const Dictionary &other) const {
+            return id == other.id && index == other.index && previous == other.previous;
+        }
+
+    private:
+        static uint32_t pack(const uint8_t *p, int channels) {
+            std::array<uint8_t, 4> bgra{p[0], p[1], p[2], channels == 4 ? p[3] : uint8_t{255}};
+            uint32_t v;
+            std::memcpy(&v, bgra.data(), sizeof(v));
+            return v;
+        }
+
+        static Pixel unpack(uint32_t v) {
+            Pixel p;
+            std::memcpy(&p[0], &v, sizeof(v));
+            return p;
+        }
+
+        static std::array<uint8_t, 4> toRGBA(const Pixel &p) {
+            return {p[2], p[1], p[0], p[3]};
+        }
+
+        static Pixel fromRGBA(const uint8_t *p) {
+            return {p[2], p[1], p[0], p[3]};
+        }
+
+        static std::map<uint32_t, Dictionary>& registry() {
+            static std::map<uint32_t, Dictionary> r;
+            return r;
+        }
+
+        static std::mutex& registryMutex() {
+            static std::mutex m;
+            return m;
+        }
+    };
+
+    // std::streambuf over a fixed block of memory, lets an Encoder write straight into a preallocated
+    // buffer sized with Encoder::maxSize(). Writing past the end fails the stream.
+    class FixedBuf : public std::streambuf
+    {
+    public:
+        FixedBuf(char *data, size_t size) {
+            setp(data, data + size);
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(pptr() - pbase());
+        }
+    };
+
+    // Pass-through std::streambuf, keeps the CRC32C of everything written to target.
+    class Crc32cBuf : public std::streambuf
+    {
+    public:
+        explicit Crc32cBuf(std::streambuf *target) : target(target) {}
+
+        uint32_t crc() const {
+            return value;
+        }
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            auto written = target->sputn(s, n);
+            value = crc32c::update(value, reinterpret_cast<const uint8_t*>(s), static_cast<size_t>(written));
+            return written;
+        }
+
+        int_type overflow(int_type c) override {
+            if (traits_type::eq_int_type(c, traits_type::eof())) {
+                return traits_type::not_eof(c);
+            }
+            char ch = traits_type::to_char_type(c);
+            return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+        }
+
+        int sync() override {
+            return target->pubsync();
+        }
+
+    private:
+        std::streambuf *target;
+        uint32_t value{0};
+    };
+
+    // Writes count rows starting at first into dst, rows are stride bytes apart.
+    using RowSource = std::function<void(uint32_t first, uint32_t count, uint8_t *dst, size_t stride)>;
+
+    // Runs task(0) to task(count - 1), possibly in parallel, and returns once all of them are done.
+    using ParallelFor = std::function<void(size_t count, const std::function<void(size_t)> &task)>;
+
     template<bool hasAlpha = false,
              typename Pixel = PixelType<hasAlpha>,
              typename SignedPixel = SignedPixelType<hasAlpha>>
     class Encoder 
     {
-        using util = util<Pixel, SignedPixel, hasAlpha>;
+        using util = cvqoi::util<Pixel, SignedPixel, hasAlpha>;
     public:
-        Encoder(const cv::Mat &mat) : mat(mat) {
-            assert(((mat.channels() == 3 && !hasAlpha) || (mat.channels() == 4 && hasAlpha)) 
-                    && "cv::Mat must have 3 or 4 channels.");
+        // Core constructor, works on any interleaved 8-bit BGR/A buffer. Nothing is copied
+        // so data must outlive the Encoder. Stride is the distance between rows in bytes.
+        Encoder(const uint8_t *data, uint32_t width, uint32_t height, size_t stride, int channels)
+            : data(data), width(width), height(height), stride(stride) {
+            assert(((channels == 3 && !hasAlpha) || (channels == 4 && hasAlpha)) 
+                    && "Image must have 3 or 4 channels.");
+            assert(stride >= width * sizeof(Pixel) && "Stride must be at least a row of pixels.");
+        }
+
+        // Out-of-core constructor for images that do not fit in memory. The source is asked for
+        // bands of bandRows rows, packed without padding, and at most two bands are held at a time.
+        Encoder(RowSource source, uint32_t width, uint32_t height, uint32_t bandRows = 256)
+            : Encoder(nullptr, width, height, width * sizeof(Pixel), hasAlpha ? 4 : 3) {
+            assert(bandRows > 0 && "Bands must have at least one row.");
+            this->source = std::move(source);
+            this->bandRows = bandRows;
+        }
+
+        Encoder(const cv::Mat &mat) 
+            : Encoder(mat.data, static_cast<uint32_t>(mat.cols), static_cast<uint32_t>(mat.rows), mat.step[0], mat.channels()) {
             assert(mat.depth() ==  CV_8U && "cv::Mat must have depth of 8 bits.");
+        }
 
-            if (hasAlpha) {
-                util::alpha(previousPixel) = 255;
-                arr.fill({0, 0, 0, 0});
+        // Emit a row index after EOS with a checkpoint every interval rows, see rowindex.
+        // Zero (the default) disables it.
+        Encoder& rowIndex(uint32_t interval) {
+            rowIndexInterval = interval;
+            return *this;
+        }
+
+        // Applies a lossless pre-filter, see Filter. Anything but Filter::None writes a container
+        // header and needs cvqoi::Decoder to read it back.
+        Encoder& filter(Filter f) {
+            filterMode = f;
+            return *this;
+        }
+
+        // Lossy but still standard QOI: every channel of a decoded pixel may be off by up to
+        // maxError, which lets far more pixels become run, index, diff or luma chunks.
+        // Zero (the default) is lossless.
+        Encoder& nearLossless(uint8_t maxError) {
+            this->maxError = maxError;
+            return *this;
+        }
+
+        // Non-standard profile with the largeindex cache, see there. Written with a container header
+        // and needs cvqoi::Decoder to read it back. A row index is still written but not used for
+        // seeking, its checkpoints do not hold the large cache.
+        Encoder& largeIndex(bool enable = true) {
+            largeIndexEnabled = enable;
+            return *this;
+        }
+
+        // Starts from a trained Dictionary instead of the empty table. The stream references it by
+        // id in a container header, decoders need it registered with Dictionary::add. Nothing is
+        // copied so it must outlive the Encoder.
+        Encoder& dictionary(const Dictionary &d) {
+            if (!hasAlpha && d.previous[3] != 255) {
+                throw std::invalid_argument("Dictionaries for images without alpha must start from an opaque pixel");
             }
-            else {
-                arr.fill({0, 0, 0});
+            dict = &d;
+            return *this;
+        }
+
+        // Writes the pixels in Adam7 order, a 1/64 subsample first and then the refinement passes, so
+        // viewers can show a preview long before the stream is complete, see Decoder::decodeProgressive.
+        // Written with a container header. Can not be combined with a row index, Filter::Vertical
+        // or a RowSource.
+        Encoder& interlaced(bool enable = true) {
+            interlace = enable;
+            return *this;
+        }
+
+        // Encodes the image rotated or mirrored, see Transform. The header gets the transformed size.
+        // The transposing ones read the source in blocks of rows so the column walk stays in cache.
+        // Can not be combined with interlacing or a RowSource.
+        Encoder& transform(Transform t) {
+            // width and height are always those of the encoded image.
+            if (transposes(t) != transposes(transformMode)) {
+                std::swap(width, height);
+            }
+            transformMode = t;
+            return *this;
+        }
+
+        // Splits the image into count horizontal stripes that are encoded in parallel, the stream stays
+        // the same byte for byte. Each stripe is scanned first for the index entries and trailing run
+        // it leaves behind, which gives the state the next one starts from. run executes the tasks,
+        // by default each gets a std::async thread. Only for lossless encoding without a pre-filter,
+        // the large index, a row index, interlacing, transforms or a RowSource.
+        Encoder& stripes(uint32_t count, ParallelFor run = {}) {
+            stripeCount = std::max<uint32_t>(count, 1);
+            stripeRunner = std::move(run);
+            return *this;
+        }
+
+        // Appends a checksum trailer with the CRC32C of everything written, see Decoder::verify.
+        // Computed while the bytes are written and ignored by decoders that follow the spec.
+        Encoder& checksum(bool enable = true) {
+            checksumEnabled = enable;
+            return *this;
+        }
+
+        // The QOI header this Encoder writes.
+        Header info() const {
+            return {width, height, hasAlpha ? 4 : 3, 1};
+        }
+
+        // Upper bound of the encoded size, every pixel costs at most a full rgb/rgba chunk.
+        uint64_t maxSize() const {
+            uint64_t pixels = static_cast<uint64_t>(width) * height;
+            uint64_t size = qoi::HEADER_SIZE + pixels * (sizeof(Pixel) + 1) + qoi::EOS.size();
+            if (hasContainer()) {
+                size += container::HEADER_SIZE + (dict ? sizeof(dict->id) : 0);
+            }
+            if (rowIndexInterval > 0) {
+                uint64_t checkpoints = height > 0 ? (height - 1) / rowIndexInterval : 0;
+                size += checkpoints * rowindex::CHECKPOINT_SIZE + rowindex::FOOTER_SIZE;
             }
+            if (checksumEnabled) {
+                size += checksum::TRAILER_SIZE;
+            }
+            return size;
         }
 
         friend std::ostream& operator<<(std::ostream &os, const Encoder &e) {
-            e.header(os);
-            e.encodeImage(os);
-            e.markEnd(os);
+            if (e.maxError > 0 && e.filterMode != Filter::None) {
+                throw std::logic_error("Near-lossless encoding can not be combined with a pre-filter");
+            }
+            if (e.interlace && (e.rowIndexInterval > 0 || e.filterMode == Filter::Vertical || e.source)) {
+                throw std::logic_error("Interlaced encoding can not be combined with a row index, "
+                                       "Filter::Vertical or a RowSource");
+            }
+            if (e.transformMode != Transform::None && (e.interlace || e.source)) {
+                throw std::logic_error("Transforms can not be combined with interlacing or a RowSource");
+            }
+            if (e.stripeCount > 1 && (e.maxError > 0 || e.filterMode != Filter::None || e.largeIndexEnabled 
+                                      || e.rowIndexInterval > 0 || e.interlace || e.transformMode != Transform::None 
+                                      || e.source)) {
+                throw std::logic_error("Stripes can only be used for lossless encoding without a pre-filter, the large "
+                                       "index, a row index, interlacing, transforms or a RowSource");
+            }
+            e.reset();
+            if (!e.checksumEnabled) {
+                e.write(os);
+                return os;
+            }
+            Crc32cBuf buf(os.rdbuf());
+            std::ostream out(&buf);
+            e.write(out);
+            if (!out) {
+                os.setstate(std::ios::badbit);
+                return os;
+            }
+            util::writeToStream(buf.crc(), os);
+            util::writeArrayToStream(checksum::MAGIC, os);
             return os;
         }
 
     private:
-        void header(std::ostream &os) const {
-            if (mat.rows > std::numeric_limits<uint32_t>::max() || mat.cols > std::numeric_limits<uint32_t>::max()) {
-                throw std::overflow_error("One of the image dimensions is larger than the supported maximum size(32-bit)");
+        void write(std::ostream &os) const {
+            CVQOI_TRACE_SPAN("encode");
+            {
+                CVQOI_TRACE_SPAN("header");
+                if (hasContainer()) {
+                    containerHeader(os);
+                }
+                header(os);
+            }
+            encodeImage(os);
+            {
+                CVQOI_TRACE_SPAN("markEnd");
+                markEnd(os);
+            }
+            if (rowIndexInterval > 0) {
+                CVQOI_TRACE_SPAN("rowIndex");
+                writeRowIndex(os);
+            }
+        }
+
+        bool hasContainer() const {
+            return filterMode != Filter::None || largeIndexEnabled || dict || interlace;
+        }
+
+        // Not counted in bytesWritten, row index offsets are relative to the QOI stream.
+        void containerHeader(std::ostream &os) const {
+            util::writeArrayToStream(container::MAGIC, os);
+            uint8_t flags = (largeIndexEnabled ? container::flags::LARGE_INDEX : 0) 
+                            | (dict ? container::flags::DICTIONARY : 0)
+                            | (interlace ? container::flags::INTERLACED : 0);
+            std::array<uint8_t, 4> fields{container::VERSION, static_cast<uint8_t>(filterMode), flags, 0};
+            util::writeArrayToStream(fields, os);
+            if (dict) {
+                util::writeToStream(dict->id, os);
+            }
+        }
+
+        // Puts the tables in the state the decoder starts from, the spec's or the dictionary's.
+        void reset() const {
+            Dictionary::Pixel initial{0, 0, 0, 255};
+            std::array<Dictionary::Pixel, 64> table{};
+            if (dict) {
+                initial = dict->previous;
+                table = dict->index;
+                // The decoder stores the initial pixel if the image starts with a run, the encoder
+                // does not. Both store it up front so they agree either way.
+                table[cvqoi::util<Dictionary::Pixel, SignedPixelType<true>, true>::hash(initial)] = initial;
+            }
+            for (int i = 0; i < (hasAlpha ? 4 : 3); ++i) {
+                previousPixel[i] = initial[i];
+            }
+            for (size_t i = 0; i < arr.size(); ++i) {
+                if constexpr (hasAlpha) {
+                    arr[i] = table[i];
+                }
+                else if (table[i][3] == 255) {
+                    arr[i] = {table[i][0], table[i][1], table[i][2]};
+                }
+                else {
+                    // An opaque pixel never matches a transparent entry. Without alpha it would, so
+                    // the slot gets a pixel that hashes elsewhere and can never be looked up there.
+                    arr[i] = poison(i, util::hash);
+                }
+            }
+            large.clear();
+            if (largeIndexEnabled) {
+                large.resize(largeindex::SIZE);
+                if constexpr (!hasAlpha) {
+                    large[util::largeHash(Pixel{})] = poison(util::largeHash(Pixel{}), util::largeHash);
+                }
+                // Same as without a dictionary above, the decoder may or may not store the initial pixel.
+                large[util::largeHash(previousPixel)] = poison(util::largeHash(previousPixel), util::largeHash);
             }
-            uint32_t width = mat.cols;
-            uint32_t height = mat.rows;
-            uint8_t channels = mat.channels();
-            uint8_t colorspace = 1;
-            util::writeArrayToStream(qoi::MAGIC, os);
-            util::writeToStream(width, os);
-            util::writeToStream(height, os);
-            util::writeToStream(channels, os);
-            util::writeToStream(colorspace, os);
+            runningPixCnt = 0;
+            bytesWritten = 0;
+            checkpoints.str({});
+            above.clear();
+        }
+
+        template<typename Hash>
+        static Pixel poison(uint32_t slot, Hash hash) {
+            auto p = Pixel::all(255);
+            return static_cast<uint32_t>(hash(p)) == slot ? Pixel::all(0) : p;
+        }
+
+        void header(std::ostream &os) const {
+            auto h = info();
+            writeArrayToStream(qoi::MAGIC, os);
+            writeToStream(h.width, os);
+            writeToStream(h.height, os);
+            writeToStream(h.channels, os);
+            writeToStream(h.colorspace, os);
         }
 
         void encodeImage(std::ostream &os) const {
-            for (int r = 0; r < mat.rows; ++r) {
-                auto *currentRow = mat.ptr<Pixel>(r);
-                for (int c = 0; c < mat.cols; ++c) {
-                    auto &currentPixel = currentRow[c];
-                    #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                    boost::optional<std::pair<uint8_t, uint8_t>> currentTag{boost::none};
-                    //std::cout << "currentPixel: " << currentPixel << ", ";
-                    //std::cout << "previousPixel: " << previousPixel << std::endl;
-                    #endif
-
-                    if (currentPixel == previousPixel) {
-                        ++runningPixCnt;
-                        if (runningPixCnt == run::UPPER_LIMIT || isLastPixel({r, c})) {
-                            runningPixCnt -= run::BIAS;
-                            util::writeToStream(runChunk(), os);
-                            runningPixCnt = 0;
-                            #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                            currentTag.emplace(std::make_pair(run::TAG, 255));
-                            #endif
+            if (source) {
+                encodeBands(os);
+                return;
+            }
+            if (interlace) {
+                CVQOI_TRACE_SPAN("encodeImage");
+                encodeInterlaced(os);
+                return;
+            }
+            if (transformMode != Transform::None) {
+                CVQOI_TRACE_SPAN("encodeImage");
+                encodeTransformed(os);
+                return;
+            }
+            if (stripeCount > 1 && height > 1 && width > 0) {
+                encodeStriped(os);
+                return;
+            }
+            for (uint32_t first = 0; first < height; first += trace::BAND_ROWS) {
+                CVQOI_TRACE_SPAN("encodeImage");
+                auto last = std::min(height, first + trace::BAND_ROWS);
+                for (uint32_t r = first; r < last; ++r) {
+                    encodeRow(r, reinterpret_cast<const Pixel*>(data + r * stride), os);
+                }
+            }
+        }
+
+        // Double buffered: the next band is read on a background thread while the current one is encoded.
+        void encodeBands(std::ostream &os) const {
+            size_t bandStride = width * sizeof(Pixel);
+            std::array<std::vector<uint8_t>, 2> bands;
+            auto fill = [this, bandStride](uint32_t first, std::vector<uint8_t> &band) {
+                CVQOI_TRACE_SPAN("readBand");
+                auto count = std::min(bandRows, height - first);
+                band.resize(count * bandStride);
+                source(first, count, band.data(), bandStride);
+            };
+            auto next = std::async(std::launch::async, fill, 0, std::ref(bands[0]));
+            for (uint32_t first = 0, current = 0;; first += bandRows, current ^= 1) {
+                next.get();
+                bool lastBand = height - first <= bandRows;
+                if (!lastBand) {
+                    next = std::async(std::launch::async, fill, first + bandRows, std::ref(bands[current ^ 1]));
+                }
+                CVQOI_TRACE_SPAN("encodeImage");
+                auto count = std::min(bandRows, height - first);
+                for (uint32_t r = 0; r < count; ++r) {
+                    encodeRow(first + r, reinterpret_cast<const Pixel*>(bands[current].data() + r * bandStride), os);
+                }
+                if (lastBand) {
+                    break;
+                }
+            }
+        }
+
+        // Three steps, the first and last in parallel: summarize every stripe on its own, chain the
+        // summaries into the state each stripe starts from, encode the stripes from those states.
+        void encodeStriped(std::ostream &os) const {
+            auto count = std::min(stripeCount, height);
+            std::vector<uint32_t> first(count + 1);
+            for (uint32_t k = 0; k <= count; ++k) {
+                first[k] = static_cast<uint32_t>(static_cast<uint64_t>(height) * k / count);
+            }
+            auto run = stripeRunner ? stripeRunner : ParallelFor(asyncFor);
+
+            // What a stripe does to the encoder state, whatever state it starts from. Only its first
+            // pixel depends on that, it may continue a run.
+            struct Summary {
+                std::array<Pixel, 64> last;  // Per slot, the last pixel after the first one that is not part of a run.
+                std::array<bool, 64> seen{};
+                Pixel front;
+                Pixel back;
+                uint64_t trailing{0};        // Pixels at the end equal to the one before them.
+                bool uniform{false};
+            };
+            std::vector<Summary> summaries(count);
+            run(count, [&](size_t k) {
+                CVQOI_TRACE_SPAN("scanStripe");
+                auto &s = summaries[k];
+                s.front = *reinterpret_cast<const Pixel*>(data + first[k] * stride);
+                auto previous = s.front;
+                uint64_t trailing = 0;
+                for (uint32_t r = first[k]; r < first[k + 1]; ++r) {
+                    auto *row = reinterpret_cast<const Pixel*>(data + r * stride);
+                    for (uint32_t c = r == first[k] ? 1 : 0; c < width; ++c) {
+                        if (row[c] == previous) {
+                            ++trailing;
+                            continue;
                         }
+                        auto idx = util::hash(row[c]);
+                        s.last[idx] = row[c];
+                        s.seen[idx] = true;
+                        previous = row[c];
+                        trailing = 0;
+                    }
+                }
+                s.back = previous;
+                s.trailing = trailing;
+                s.uniform = trailing + 1 == static_cast<uint64_t>(first[k + 1] - first[k]) * width;
+            });
+
+            // Every pixel that is not part of a run ends up in its index slot, runs leave the table alone.
+            struct Start {
+                std::array<Pixel, 64> arr;
+                Pixel previousPixel;
+                uint8_t runningPixCnt;
+            };
+            std::vector<Start> starts(count);
+            Start state{arr, previousPixel, runningPixCnt};
+            for (uint32_t k = 0; k < count; ++k) {
+                starts[k] = state;
+                auto &s = summaries[k];
+                uint64_t pending = s.trailing;
+                if (s.front != state.previousPixel) {
+                    state.arr[util::hash(s.front)] = s.front;
+                }
+                else if (s.uniform) {
+                    pending += state.runningPixCnt + 1;
+                }
+                for (size_t i = 0; i < state.arr.size(); ++i) {
+                    if (s.seen[i]) {
+                        state.arr[i] = s.last[i];
+                    }
+                }
+                state.previousPixel = s.back;
+                state.runningPixCnt = static_cast<uint8_t>(pending % run::UPPER_LIMIT);
+            }
+
+            std::vector<std::ostringstream> parts(count);
+            run(count, [&](size_t k) {
+                CVQOI_TRACE_SPAN("encodeImage");
+                auto rows = first[k + 1] - first[k];
+                Encoder part(data + first[k] * stride, width, rows, stride, hasAlpha ? 4 : 3);
+                part.arr = starts[k].arr;
+                part.previousPixel = starts[k].previousPixel;
+                part.runningPixCnt = starts[k].runningPixCnt;
+                for (uint32_t r = 0; r < rows; ++r) {
+                    part.encodePixels(reinterpret_cast<const Pixel*>(part.data + r * stride), width,
+                                      k == count - 1 && r == rows - 1, parts[k]);
+                }
+            });
+            for (auto &part : parts) {
+                auto bytes = part.str();
+                os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            }
+        }
+
+        static void asyncFor(size_t count, const std::function<void(size_t)> &task) {
+            std::vector<std::future<void>> tasks;
+            for (size_t i = 1; i < count; ++i) {
+                tasks.push_back(std::async(std::launch::async, task, i));
+            }
+            task(0);
+            for (auto &t : tasks) {
+                t.get();
+            }
+        }
+
+        static bool transposes(Transform t) {
+            return t == Transform::Rotate90 || t == Transform::Rotate270 || t == Transform::Transpose;
+        }
+
+        void encodeTransformed(std::ostream &os) const {
+            std::vector<Pixel> rows;
+            if (!transposes(transformMode)) {
+                bool upsideDown = transformMode == Transform::Rotate180 || transformMode == Transform::FlipVertical;
+                bool mirrored = transformMode == Transform::Rotate180 || transformMode == Transform::FlipHorizontal;
+                rows.resize(mirrored ? width : 0);
+                for (uint32_t r = 0; r < height; ++r) {
+                    auto *src = reinterpret_cast<const Pixel*>(data + (upsideDown ? height - 1 - r : r) * stride);
+                    if (mirrored) {
+                        std::reverse_copy(src, src + width, rows.begin());
+                        src = rows.data();
+                    }
+                    encodeRow(r, src, os);
+                }
+                return;
+            }
+            // Output row r is source column r (Rotate270 counts from the right), output column c is
+            // source row c (Rotate90 counts from the bottom). BLOCK output rows are gathered at once,
+            // each source row is then read as one short contiguous run instead of a pixel per row.
+            constexpr uint32_t BLOCK = 32;
+            rows.resize(static_cast<size_t>(BLOCK) * width);
+            for (uint32_t first = 0; first < height; first += BLOCK) {
+                auto count = std::min(BLOCK, height - first);
+                for (uint32_t c = 0; c < width; ++c) {
+                    auto sourceRow = transformMode == Transform::Rotate90 ? width - 1 - c : c;
+                    auto *src = reinterpret_cast<const Pixel*>(data + sourceRow * stride);
+                    for (uint32_t b = 0; b < count; ++b) {
+                        auto sourceCol = transformMode == Transform::Rotate270 ? height - 1 - (first + b) : first + b;
+                        rows[b * width + c] = src[sourceCol];
+                    }
+                }
+                for (uint32_t b = 0; b < count; ++b) {
+                    encodeRow(first + b, rows.data() + b * width, os);
+                }
+            }
+        }
+
+        // Every pass row is gathered and encoded like an image row, the state carries over between passes.
+        void encodeInterlaced(std::ostream &os) const {
+            size_t lastPass = 0;
+            for (size_t i = 0; i < adam7::PASSES.size(); ++i) {
+                auto &p = adam7::PASSES[i];
+                if (adam7::count(width, p.x0, p.dx) > 0 && adam7::count(height, p.y0, p.dy) > 0) {
+                    lastPass = i;
+                }
+            }
+            std::vector<Pixel> row;
+            for (size_t i = 0; i <= lastPass; ++i) {
+                auto &p = adam7::PASSES[i];
+                auto cols = adam7::count(width, p.x0, p.dx);
+                if (cols == 0) {
+                    continue;
+                }
+                row.resize(cols);
+                for (uint32_t y = p.y0; y < height; y += p.dy) {
+                    auto *src = reinterpret_cast<const Pixel*>(data + y * stride);
+                    for (uint32_t c = 0; c < cols; ++c) {
+                        row[c] = src[p.x0 + c * p.dx];
+                    }
+                    encodePixels(row.data(), cols, i == lastPass && height - y <= p.dy, os);
+                }
+            }
+        }
+
+        void encodeRow(uint32_t r, const Pixel *currentRow, std::ostream &os) const {
+            if (rowIndexInterval > 0 && r > 0 && r % rowIndexInterval == 0) {
+                checkpoint();
+            }
+            encodePixels(currentRow, width, r == height - 1, os);
+        }
+
+        // Encodes count pixels in stream order. last means they end the image and a pending run
+        // has to be written out.
+        void encodePixels(const Pixel *currentRow, uint32_t count, bool last, std::ostream &os) const {
+            if (filterMode != Filter::None) {
+                currentRow = filterRow(currentRow, count);
+            }
+            if (maxError > 0) {
+                encodeRowNearLossless(currentRow, count, last, os);
+                return;
+            }
+            for (uint32_t c = 0; c < count; ++c) {
+                auto &currentPixel = currentRow[c];
+                #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                boost::optional<std::pair<uint8_t, uint8_t>> currentTag{boost::none};
+                //std::cout << "currentPixel: " << currentPixel << ", ";
+                //std::cout << "previousPixel: " << previousPixel << std::endl;
+                #endif
+
+                if (currentPixel == previousPixel) {
+                    ++runningPixCnt;
+                    if (runningPixCnt == runLimit() || (last && c == count - 1)) {
+                        runningPixCnt -= run::BIAS;
+                        writeToStream(runChunk(), os);
+                        runningPixCnt = 0;
+                        #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                        currentTag.emplace(std::make_pair(run::TAG, 255));
+                        #endif
+                    }
+                }
+                else {
+                    if (runningPixCnt > run::LOWER_RANGE) {
+                        runningPixCnt -= run::BIAS;
+                        writeToStream(runChunk(), os);
+                        runningPixCnt = 0;
+                    }
+
+                    auto pairIsSeenBefore = isSeenBefore(currentPixel);
+                    auto &seenBefore = pairIsSeenBefore.first;
+                    auto &arrayIdx = pairIsSeenBefore.second;
+                    if (seenBefore) {
+                        writeToStream(indexChunk(arrayIdx), os);
+                        #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                        currentTag.emplace(std::make_pair(index::TAG, arrayIdx));
+                        #endif
+                    }
+                    else if (isInLargeIndex(currentPixel)) {
+                        arr[arrayIdx] = currentPixel;
+                        writeArrayToStream(largeIndexChunk(util::largeHash(currentPixel)), os);
+                        #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                        currentTag.emplace(std::make_pair(largeindex::TAG, 255));
+                        #endif
                     }
                     else {
-                        if (runningPixCnt > run::LOWER_RANGE) {
-                            runningPixCnt -= run::BIAS;
-                            util::writeToStream(runChunk(), os);
-                            runningPixCnt = 0;
-                        }
+                        arr[arrayIdx] = currentPixel;
 
-                        auto pairIsSeenBefore = isSeenBefore(currentPixel);
-                        auto &seenBefore = pairIsSeenBefore.first;
-                        auto &arrayIdx = pairIsSeenBefore.second;
-                        if (seenBefore) {
-                            util::writeToStream(indexChunk(arrayIdx), os);
+                        SignedPixel dp, lumaDp;
+                        util::blue(dp) = util::blue(currentPixel) - util::blue(previousPixel);
+                        util::green(dp) = util::green(currentPixel) - util::green(previousPixel);
+                        util::red(dp) = util::red(currentPixel) - util::red(previousPixel);
+                        if (hasAlpha) {
+                            util::alpha(dp) = util::alpha(currentPixel) - util::alpha(previousPixel);
+                        }
+                        if (hasAlpha && util::alpha(dp) != 0) {
+                            writeArrayToStream(rgbaChunk(currentPixel), os);
                             #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                            currentTag.emplace(std::make_pair(index::TAG, arrayIdx));
+                            currentTag.emplace(std::make_pair(rgba::TAG, 255));
                             #endif
                         }
                         else {
-                            arr[arrayIdx] = currentPixel;
-
-                            SignedPixel dp, lumaDp;
-                            util::blue(dp) = util::blue(currentPixel) - util::blue(previousPixel);
-                            util::green(dp) = util::green(currentPixel) - util::green(previousPixel);
-                            util::red(dp) = util::red(currentPixel) - util::red(previousPixel);
-                            if (hasAlpha) {
-                                util::alpha(dp) = util::alpha(currentPixel) - util::alpha(previousPixel);
+                            if (util::isInDiffRange(dp)) {
+                                util::blue(dp) += diff::BIAS;
+                                util::green(dp) += diff::BIAS;
+                                util::red(dp) += diff::BIAS;
+                                writeToStream(diffChunk(dp), os);
+                                #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                                currentTag.emplace(std::make_pair(diff::TAG, 255));
+                                #endif
                             }
-                            if (hasAlpha && util::alpha(dp) != 0) {
-                                util::writeArrayToStream(rgbaChunk(currentPixel), os);
+                            else if (util::isInLumaRange(dp, lumaDp)) {
+                                util::blue(lumaDp) += luma::red_blue::BIAS;
+                                util::green(lumaDp) += luma::green::BIAS;
+                                util::red(lumaDp) += luma::red_blue::BIAS;
+                                writeArrayToStream(lumaChunk(lumaDp), os);
                                 #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                                currentTag.emplace(std::make_pair(rgba::TAG, 255));
+                                currentTag.emplace(std::make_pair(luma::TAG, 255));
                                 #endif
                             }
                             else {
-                                if (util::isInDiffRange(dp)) {
-                                    util::blue(dp) += diff::BIAS;
-                                    util::green(dp) += diff::BIAS;
-                                    util::red(dp) += diff::BIAS;
-                                    util::writeToStream(diffChunk(dp), os);
-                                    #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                                    currentTag.emplace(std::make_pair(diff::TAG, 255));
-                                    #endif
-                                }
-                                else if (util::isInLumaRange(dp, lumaDp)) {
-                                    util::blue(lumaDp) += luma::red_blue::BIAS;
-                                    util::green(lumaDp) += luma::green::BIAS;
-                                    util::red(lumaDp) += luma::red_blue::BIAS;
-                                    util::writeArrayToStream(lumaChunk(lumaDp), os);
-                                    #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                                    currentTag.emplace(std::make_pair(luma::TAG, 255));
-                                    #endif
-                                }
-                                else {
-                                    util::writeArrayToStream(rgbChunk(currentPixel), os);
-                                    #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                                    currentTag.emplace(std::make_pair(rgb::TAG, 255));
-                                    #endif
-                                }
+                                writeArrayToStream(rgbChunk(currentPixel), os);
+                                #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                                currentTag.emplace(std::make_pair(rgb::TAG, 255));
+                                #endif
                             }
                         }
-                        previousPixel = currentPixel;
                     }
-                    #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
-                    //std::cout << "currentTag: " << (currentTag.has_value() ? +currentTag.value().first : -1) << ", ";
-                    //std::cout << "previousTag: " << (previousTag.has_value() ? +previousTag.value().first : -1) << std::endl;
-                    assert(!(currentTag.has_value() && previousTag.has_value()
-                             && previousTag.value().first == index::TAG && currentTag.value().first == index::TAG
-                             && previousTag.value().second == currentTag.value().second) 
-                             && "Cannot emit two index tags in a row for the same index!");
-                    previousTag = currentTag;
-                    #endif
+                    if (!large.empty()) {
+                        large[util::largeHash(currentPixel)] = currentPixel;
+                    }
+                    previousPixel = currentPixel;
+                }
+                #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
+                //std::cout << "currentTag: " << (currentTag.has_value() ? +currentTag.value().first : -1) << ", ";
+                //std::cout << "previousTag: " << (previousTag.has_value() ? +previousTag.value().first : -1) << std::endl;
+                assert(!(currentTag.has_value() && previousTag.has_value()
+                         && previousTag.value().first == index::TAG && currentTag.value().first == index::TAG
+                         && previousTag.value().second == currentTag.value().second) 
+                         && "Cannot emit two index tags in a row for the same index!");
+                previousTag = currentTag;
+                #endif
+            }
+        }
+
+        const Pixel* filterRow(const Pixel *row, uint32_t count) const {
+            filtered.resize(count);
+            if (filterMode == Filter::YCoCgR) {
+                for (uint32_t c = 0; c < count; ++c) {
+                    filtered[c] = row[c];
+                    ycocg::forward(util::blue(filtered[c]), util::green(filtered[c]), util::red(filtered[c]));
+                }
+            }
+            else {
+                // Row 0 is predicted from zeros, same as the decoder.
+                above.resize(count);
+                for (uint32_t c = 0; c < count; ++c) {
+                    for (int i = 0; i < (hasAlpha ? 4 : 3); ++i) {
+                        filtered[c][i] = row[c][i] - above[c][i];
+                    }
+                }
+                std::copy(row, row + count, above.begin());
+            }
+            return filtered.data();
+        }
+
+        // Same chunk order as encodeRow, but each chunk is taken when the pixel it reconstructs is
+        // within maxError of the source. previousPixel and arr track the reconstructed pixels,
+        // exactly like the decoder, so errors never accumulate.
+        void encodeRowNearLossless(const Pixel *currentRow, uint32_t count, bool last, std::ostream &os) const {
+            for (uint32_t c = 0; c < count; ++c) {
+                const auto &currentPixel = currentRow[c];
+                if (isClose(currentPixel, previousPixel)) {
+                    ++runningPixCnt;
+                    if (runningPixCnt == runLimit() || (last && c == count - 1)) {
+                        runningPixCnt -= run::BIAS;
+                        writeToStream(runChunk(), os);
+                        runningPixCnt = 0;
+                    }
+                    continue;
+                }
+                if (runningPixCnt > run::LOWER_RANGE) {
+                    runningPixCnt -= run::BIAS;
+                    writeToStream(runChunk(), os);
+                    runningPixCnt = 0;
+                }
+
+                Pixel reconstructed = previousPixel;
+                SignedPixel dp;
+                auto arrayIdx = util::hash(currentPixel);
+                // Only entries stored under their own hash are what the decoder has in that slot.
+                if (isClose(currentPixel, arr[arrayIdx]) && util::hash(arr[arrayIdx]) == arrayIdx) {
+                    writeToStream(indexChunk(arrayIdx), os);
+                    reconstructed = arr[arrayIdx];
+                }
+                else if (auto largeIdx = util::largeHash(currentPixel); !large.empty() 
+                         && isClose(currentPixel, large[largeIdx]) && util::largeHash(large[largeIdx]) == largeIdx) {
+                    writeArrayToStream(largeIndexChunk(largeIdx), os);
+                    reconstructed = large[largeIdx];
+                }
+                else if (hasAlpha && absDiff(util::alpha(currentPixel), util::alpha(previousPixel)) > maxError) {
+                    writeArrayToStream(rgbaChunk(currentPixel), os);
+                    reconstructed = currentPixel;
+                }
+                else if (snapDiff(currentPixel, dp, reconstructed)) {
+                    writeToStream(diffChunk(dp), os);
+                }
+                else if (snapLuma(currentPixel, dp, reconstructed)) {
+                    writeArrayToStream(lumaChunk(dp), os);
+                }
+                else {
+                    writeArrayToStream(rgbChunk(currentPixel), os);
+                    util::blue(reconstructed) = util::blue(currentPixel);
+                    util::green(reconstructed) = util::green(currentPixel);
+                    util::red(reconstructed) = util::red(currentPixel);
+                }
+                arr[util::hash(reconstructed)] = reconstructed;
+                if (!large.empty()) {
+                    large[util::largeHash(reconstructed)] = reconstructed;
+                }
+                previousPixel = reconstructed;
+            }
+        }
+
+        static int absDiff(uint8_t a, uint8_t b) {
+            return a > b ? a - b : b - a;
+        }
+
+        bool isClose(const Pixel &a, const Pixel &b) const {
+            for (int i = 0; i < (hasAlpha ? 4 : 3); ++i) {
+                if (absDiff(a[i], b[i]) > maxError) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Picks the delta in [lower, upper] closest to the wrapped delta from base to target and
+        // applies it to base. False if the result is further than maxError from target.
+        bool snapChannel(uint8_t base, uint8_t target, int delta, int lower, int upper, 
+                         int &snapped, uint8_t &result) const {
+            snapped = std::min(std::max(delta, lower), upper);
+            result = static_cast<uint8_t>(base + snapped);
+            return absDiff(result, target) <= maxError;
+        }
+
+        // Fills dp with a biased diff chunk and reconstructed with what it decodes to.
+        bool snapDiff(const Pixel &p, SignedPixel &dp, Pixel &reconstructed) const {
+            for (int i = 0; i < 3; ++i) {
+                int d = static_cast<int8_t>(p[i] - previousPixel[i]);
+                int snapped;
+                if (!snapChannel(previousPixel[i], p[i], d, diff::LOWER_RANGE + 1, diff::UPPER_RANGE - 1, 
+                                 snapped, reconstructed[i])) {
+                    reconstructed = previousPixel;
+                    return false;
                 }
+                dp[i] = static_cast<int8_t>(snapped + diff::BIAS);
             }
+            return true;
+        }
+
+        // Same for luma. Green is tried at every value within maxError, a green slightly off
+        // can bring red and blue into range.
+        bool snapLuma(const Pixel &p, SignedPixel &dp, Pixel &reconstructed) const {
+            int dg = static_cast<int8_t>(util::green(p) - util::green(previousPixel));
+            int dr = static_cast<int8_t>(util::red(p) - util::red(previousPixel));
+            int db = static_cast<int8_t>(util::blue(p) - util::blue(previousPixel));
+            for (int offset = 0; offset <= 2 * maxError; ++offset) {
+                // 0, -1, +1, -2, +2...
+                int dgCandidate = dg + ((offset & 1) ? -(offset + 1) / 2 : offset / 2);
+                if (dgCandidate <= luma::green::LOWER_RANGE || dgCandidate >= luma::green::UPPER_RANGE) {
+                    continue;
+                }
+                uint8_t green = static_cast<uint8_t>(util::green(previousPixel) + dgCandidate);
+                if (absDiff(green, util::green(p)) > maxError) {
+                    continue;
+                }
+                int drg, dbg;
+                uint8_t red, blue;
+                uint8_t redBase = static_cast<uint8_t>(util::red(previousPixel) + dgCandidate);
+                uint8_t blueBase = static_cast<uint8_t>(util::blue(previousPixel) + dgCandidate);
+                if (snapChannel(redBase, util::red(p), dr - dgCandidate, 
+                                luma::red_blue::LOWER_RANGE + 1, luma::red_blue::UPPER_RANGE - 1, drg, red)
+                    && snapChannel(blueBase, util::blue(p), db - dgCandidate, 
+                                   luma::red_blue::LOWER_RANGE + 1, luma::red_blue::UPPER_RANGE - 1, dbg, blue)) {
+                    util::green(dp) = static_cast<int8_t>(dgCandidate + luma::green::BIAS);
+                    util::red(dp) = static_cast<int8_t>(drg + luma::red_blue::BIAS);
+                    util::blue(dp) = static_cast<int8_t>(dbg + luma::red_blue::BIAS);
+                    util::green(reconstructed) = green;
+                    util::red(reconstructed) = red;
+                    util::blue(reconstructed) = blue;
+                    return true;
+                }
+            }
+            return false;
         }
 
         void markEnd(std::ostream &os) const {
-            util::writeArrayToStream(qoi::EOS, os);
+            writeArrayToStream(qoi::EOS, os);
+        }
+
+        void checkpoint() const {
+            auto toRGBA = [](const Pixel &p) {
+                uint8_t a = 255;
+                if constexpr (hasAlpha) {
+                    a = util::alpha(p);
+                }
+                return std::array<uint8_t, 4>{util::red(p), util::green(p), util::blue(p), a};
+            };
+            util::writeToStream(bytesWritten, checkpoints);
+            util::writeToStream(runningPixCnt, checkpoints);
+            util::writeArrayToStream(toRGBA(previousPixel), checkpoints);
+            for (const auto &p : arr) {
+                util::writeArrayToStream(toRGBA(p), checkpoints);
+            }
+        }
+
+        void writeRowIndex(std::ostream &os) const {
+            auto entries = checkpoints.str();
+            uint32_t count = entries.size() / rowindex::CHECKPOINT_SIZE;
+            os.write(entries.data(), entries.size());
+            util::writeToStream(rowIndexInterval, os);
+            util::writeToStream(count, os);
+            util::writeArrayToStream(rowindex::MAGIC, os);
         }
 
-        bool isLastPixel(const cv::Point2i &p) const {
-            return p.x == mat.rows - 1 && p.y == mat.cols - 1;
+        // Counting wrappers around util, the row index needs the offset of every checkpoint
+        // and not every std::ostream can report its position.
+        template<typename T>
+        void writeToStream(const T &t, std::ostream &os) const {
+            util::writeToStream(t, os);
+            bytesWritten += sizeof(T);
+        }
+
+        template<typename T>
+        void writeArrayToStream(const T &t, std::ostream &os) const {
+            util::writeArrayToStream(t, os);
+            bytesWritten += t.size();
         }
 
         std::pair<bool, int> isSeenBefore(const Pixel &p) const {
@@ -323,11 +1407,25 @@ namespace cvqoi
             return std::make_pair(arr[currentPixelHash] == p, currentPixelHash);
         }
 
+        bool isInLargeIndex(const Pixel &p) const {
+            return !large.empty() && large[util::largeHash(p)] == p;
+        }
+
+        // The largeindex chunk takes the top run codes.
+        uint8_t runLimit() const {
+            return large.empty() ? run::UPPER_LIMIT : largeindex::RUN_UPPER_LIMIT;
+        }
+
         index::chunk indexChunk(uint8_t idx) const {
             assert(idx < 64);
             return index::TAG | idx;
         }
 
+        largeindex::chunk largeIndexChunk(uint32_t idx) const {
+            assert(idx < largeindex::SIZE);
+            return {static_cast<uint8_t>(largeindex::TAG + (idx >> 8)), static_cast<uint8_t>(idx)};
+        }
+
         diff::chunk diffChunk(const Pixel &dp) const {
             assert(util::red(dp) < 4);
             assert(util::blue(dp) < 4);
@@ -352,7 +1450,7 @@ namespace cvqoi
         }
 
         run::chunk runChunk() const {
-            assert(runningPixCnt < 63);
+            assert(runningPixCnt < runLimit());
             return run::TAG | runningPixCnt;
         }
 
@@ -376,12 +1474,638 @@ namespace cvqoi
         }
 
     private:
-        const cv::Mat mat;
+        const uint8_t *data;
+        uint32_t width;
+        uint32_t height;
+        size_t stride;
+        RowSource source;
+        uint32_t bandRows{0};
         mutable std::array<Pixel, 64> arr{};
         mutable Pixel previousPixel{};
         mutable uint8_t runningPixCnt{};
+        uint32_t rowIndexInterval{0};
+        uint8_t maxError{0};
+        Filter filterMode{Filter::None};
+        bool largeIndexEnabled{false};
+        bool interlace{false};
+        Transform transformMode{Transform::None};
+        bool checksumEnabled{false};
+        uint32_t stripeCount{1};
+        ParallelFor stripeRunner;
+        const Dictionary *dict{nullptr};
+        mutable std::vector<Pixel> large;
+        mutable std::vector<Pixel> filtered;
+        mutable std::vector<Pixel> above;
+        mutable uint64_t bytesWritten{0};
+        mutable std::ostringstream checkpoints;
         #ifdef CVQOI_ASSERT_NO_CONSECUTIVE_INDEX
         mutable boost::optional<std::pair<uint8_t, uint8_t>> previousTag{boost::none};
         #endif
     };
+
+    // Encoder for CV_16U images with 1 to 4 channels. The high and low byte planes are encoded in
+    // parallel, the high plane of 10-12 bit sensor data is mostly runs. Always written with a
+    // container header, see wide, and read back with Decoder::decode into a cv::Mat.
+    class WideEncoder
+    {
+    public:
+        explicit WideEncoder(const cv::Mat &mat) : mat(mat) {
+            assert(mat.depth() == CV_16U && "cv::Mat must have depth of 16 bits.");
+            assert(mat.channels() >= 1 && mat.channels() <= 4 && "Image must have 1 to 4 channels.");
+        }
+
+        // Upper bound of the encoded size, see Encoder::maxSize.
+        uint64_t maxSize() const {
+            auto shape = wide::planeShape(static_cast<uint32_t>(mat.cols), mat.channels());
+            uint64_t pixels = static_cast<uint64_t>(shape.first) * mat.rows;
+            uint64_t plane = qoi::HEADER_SIZE + pixels * (shape.second + 1) + qoi::EOS.size();
+            return container::HEADER_SIZE + wide::HEADER_SIZE + 2 * plane;
+        }
+
+        friend std::ostream& operator<<(std::ostream &os, const WideEncoder &e) {
+            using util = cvqoi::util<PixelType<false>, SignedPixelType<false>>;
+            auto high = std::async(std::launch::async, [&e] { return e.encodePlane(8); });
+            auto low = e.encodePlane(0);
+            auto highPlane = high.get();
+
+            util::writeArrayToStream(container::MAGIC, os);
+            std::array<uint8_t, 4> fields{container::VERSION, static_cast<uint8_t>(Filter::None), container::flags::WIDE, 0};
+            util::writeArrayToStream(fields, os);
+            std::array<uint8_t, 4> channels{static_cast<uint8_t>(e.mat.channels()), 0, 0, 0};
+            util::writeArrayToStream(channels, os);
+            util::writeToStream(static_cast<uint32_t>(e.mat.cols), os);
+            util::writeToStream(static_cast<uint32_t>(e.mat.rows), os);
+            util::writeToStream(static_cast<uint64_t>(highPlane.size()), os);
+            os.write(highPlane.data(), highPlane.size());
+            os.write(low.data(), low.size());
+            return os;
+        }
+
+    private:
+        std::string encodePlane(int shift) const {
+            auto channels = mat.channels();
+            auto shape = wide::planeShape(static_cast<uint32_t>(mat.cols), channels);
+            size_t samples = static_cast<size_t>(mat.cols) * channels;
+            size_t rowSize = static_cast<size_t>(shape.first) * shape.second;
+            std::vector<uint8_t> plane(rowSize * mat.rows);
+            for (int r = 0; r < mat.rows; ++r) {
+                auto *src = mat.ptr<uint16_t>(r);
+                auto *dst = plane.data() + r * rowSize;
+                for (size_t i = 0; i < samples; ++i) {
+                    dst[i] = static_cast<uint8_t>(src[i] >> shift);
+                }
+                std::fill(dst + samples, dst + rowSize, samples > 0 ? dst[samples - 1] : 0);
+            }
+            std::ostringstream os;
+            if (shape.second == 4) {
+                os << Encoder<true>(plane.data(), shape.first, mat.rows, rowSize, 4);
+            }
+            else {
+                os << Encoder<>(plane.data(), shape.first, mat.rows, rowSize, 3);
+            }
+            return os.str();
+        }
+
+        cv::Mat mat;
+    };
+
+    // Decodes into BGR/A, the channel count of the output is the one in the QOI header.
+    // Usable on a stream like the Encoder, or directly on an in-memory buffer.
+    class Decoder
+    {
+        using Pixel = PixelType<true>;
+        using util = cvqoi::util<Pixel, SignedPixelType<true>, true>;
+    public:
+        explicit Decoder(cv::Mat &mat) : mat(mat) {}
+
+        // Checks the checksum trailer before decoding and throws if it does not match. Streams
+        // without one are decoded as usual.
+        Decoder& validate(bool enable = true) {
+            validateChecksum = enable;
+            return *this;
+        }
+
+        friend std::istream& operator>>(std::istream &is, const Decoder &d) {
+            std::vector<uint8_t> buf{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+            if (d.validateChecksum && verify(buf.data(), buf.size()) == Integrity::Corrupt) {
+                throw std::runtime_error("QOI checksum mismatch");
+            }
+            decode(buf.data(), buf.size(), d.mat);
+            return is;
+        }
+
+        // Checks a stream against its checksum trailer (see Encoder::checksum) without decoding it,
+        // at the speed of the CRC.
+        static Integrity verify(const uint8_t *data, size_t size) {
+            CVQOI_TRACE_SPAN("verify");
+            if (!hasChecksum(data, size)) {
+                return Integrity::Unchecked;
+            }
+            auto body = size - checksum::TRAILER_SIZE;
+            auto stored = boost::endian::load_big_u32(data + body);
+            return crc32c::update(0, data, body) == stored ? Integrity::Valid : Integrity::Corrupt;
+        }
+
+        static Header header(const uint8_t *data, size_t size) {
+            return open(data, size).header;
+        }
+
+        // Streams written by WideEncoder decode into a CV_16U cv::Mat.
+        static void decode(const uint8_t *data, size_t size, cv::Mat &mat) {
+            if (size >= container::HEADER_SIZE && std::equal(container::MAGIC.begin(), container::MAGIC.end(), data)
+                && (data[6] & container::flags::WIDE)) {
+                decodeWide(data, size, mat);
+                return;
+            }
+            auto h = header(data, size);
+            decodeRows(data, size, 0, h.height, mat);
+        }
+
+        static void decode(const uint8_t *data, size_t size, uint8_t *dst, size_t stride) {
+            auto h = header(data, size);
+            decodeRows(data, size, 0, h.height, dst, stride);
+        }
+
+        // Decodes rows [first, last) into a (last - first) high cv::Mat. When the stream has a
+        // row index (see Encoder::rowIndex) decoding starts from the closest checkpoint above first.
+        // Filter::Vertical and the largeindex profile carry state the index does not hold, those
+        // streams always start at row 0.
+        static void decodeRows(const uint8_t *data, size_t size, uint32_t first, uint32_t last, cv::Mat &mat) {
+            auto h = header(data, size);
+            mat.create(static_cast<int>(last - first), static_cast<int>(h.width), CV_8UC(h.channels));
+            decodeRows(data, size, first, last, mat.data, mat.step[0]);
+        }
+
+        static void decodeRows(const uint8_t *data, size_t size, uint32_t first, uint32_t last, 
+                               uint8_t *dst, size_t stride) {
+            CVQOI_TRACE_SPAN("decode");
+            auto s = open(data, size);
+            if (first > last || last > s.header.height) {
+                throw std::out_of_range("Requested rows are outside of the image");
+            }
+            State state(s);
+            if (s.flags & container::flags::INTERLACED) {
+                // Every row is spread over all passes, the whole image has to be decoded.
+                auto rowSize = static_cast<size_t>(s.header.width) * s.header.channels;
+                std::vector<uint8_t> full(first == 0 && last == s.header.height ? 0 : s.header.height * rowSize);
+                auto *out = full.empty() ? dst : full.data();
+                auto outStride = full.empty() ? stride : rowSize;
+                int passes = 0;
+                if (s.header.channels == 4) {
+                    decodeInterlaced<4>(s, s.size - qoi::EOS.size(), state, out, outStride, false, passes);
+                }
+                else {
+                    decodeInterlaced<3>(s, s.size - qoi::EOS.size(), state, out, outStride, false, passes);
+                }
+                for (uint32_t r = first; !full.empty() && r < last; ++r) {
+                    std::memcpy(dst + (r - first) * stride, full.data() + r * rowSize, rowSize);
+                }
+                return;
+            }
+            size_t offset = qoi::HEADER_SIZE;
+            uint64_t pixel = 0;
+            if (s.filter != Filter::Vertical && !(s.flags & container::flags::LARGE_INDEX)) {
+                seek(s, first, state, offset, pixel);
+            }
+            if (s.header.channels == 4) {
+                decodeRange<4>(s, first, last, state, offset, pixel, dst, stride);
+            }
+            else {
+                decodeRange<3>(s, first, last, state, offset, pixel, dst, stride);
+            }
+        }
+
+        // Preview from the first size bytes of an interlaced stream (see Encoder::interlaced), for
+        // example while it is still arriving. Every decoded pixel fills the block up to the next
+        // pixel of its pass, so once the first pass is in (about 1/64 of the pixels) the whole image
+        // has a coarse version. Returns the number of complete passes, 7 for the whole image.
+        // data must hold at least the headers.
+        static int decodeProgressive(const uint8_t *data, size_t size, cv::Mat &mat) {
+            CVQOI_TRACE_SPAN("decodeProgressive");
+            auto s = open(data, size, false);
+            if (!(s.flags & container::flags::INTERLACED)) {
+                throw std::invalid_argument("Progressive decoding needs an interlaced stream");
+            }
+            auto &h = s.header;
+            mat.create(static_cast<int>(h.height), static_cast<int>(h.width), CV_8UC(h.channels));
+            for (int r = 0; r < mat.rows; ++r) {
+                std::memset(mat.ptr<uint8_t>(r), 0, h.width * h.channels);
+            }
+            State state(s);
+            int passes = 0;
+            try {
+                if (h.channels == 4) {
+                    decodeInterlaced<4>(s, s.size, state, mat.data, mat.step[0], true, passes);
+                }
+                else {
+                    decodeInterlaced<3>(s, s.size, state, mat.data, mat.step[0], true, passes);
+                }
+            }
+            catch (const std::runtime_error &) {
+                // The rest of the stream has not arrived yet.
+            }
+            return passes;
+        }
+
+        enum class Downscale { Sample, Box };
+
+        // Decodes a preview that is scale times smaller in both dimensions (rounded up). Every opcode
+        // still has to be parsed, but only the output pixels are written, either the top left
+        // pixel of each scale x scale block or the average of the block.
+        static void decodeScaled(const uint8_t *data, size_t size, uint32_t scale, cv::Mat &mat, 
+                                 Downscale mode = Downscale::Box) {
+            CVQOI_TRACE_SPAN("decodeScaled");
+            auto s = open(data, size);
+            if (scale == 0) {
+                throw std::invalid_argument("Scale must be at least 1");
+            }
+            auto &h = s.header;
+            mat.create(static_cast<int>((h.height + scale - 1) / scale), static_cast<int>((h.width + scale - 1) / scale),
+                       CV_8UC(h.channels));
+            if (h.channels == 4) {
+                mode == Downscale::Box ? decodeScaled<4, true>(s, scale, mat) : decodeScaled<4, false>(s, scale, mat);
+            }
+            else {
+                mode == Downscale::Box ? decodeScaled<3, true>(s, scale, mat) : decodeScaled<3, false>(s, scale, mat);
+            }
+        }
+
+    private:
+        // The QOI stream inside a buffer, past the container header if there is one.
+        struct Stream {
+            const uint8_t *data;
+            size_t size;
+            Header header;
+            Filter filter;
+            uint8_t flags;
+            const Dictionary *dictionary;
+        };
+
+        // Plain streams end in qoi::EOS and row indexes in their MAGIC, neither can look like this.
+        static bool hasChecksum(const uint8_t *data, size_t size) {
+            return size >= checksum::TRAILER_SIZE 
+                && std::equal(checksum::MAGIC.begin(), checksum::MAGIC.end(), data + size - checksum::MAGIC.size());
+        }
+
+        // complete is false for streams that may still be arriving, only the headers have to be there.
+        static Stream open(const uint8_t *data, size_t size, bool complete = true) {
+            if (hasChecksum(data, size)) {
+                size -= checksum::TRAILER_SIZE;
+            }
+            Stream s{data, size, {}, Filter::None, 0, nullptr};
+            if (size >= container::HEADER_SIZE 
+                && std::equal(container::MAGIC.begin(), container::MAGIC.end(), data)) {
+                if (data[4] != container::VERSION) {
+                    throw std::runtime_error("Unsupported cvqoi container version");
+                }
+                if (data[5] > static_cast<uint8_t>(Filter::Vertical)) {
+                    throw std::runtime_error("Unknown cvqoi pre-filter");
+                }
+                if (data[6] & ~container::flags::KNOWN) {
+                    throw std::runtime_error("Unknown cvqoi container flags");
+                }
+                if (data[6] & container::flags::WIDE) {
+                    throw std::runtime_error("16-bit cvqoi streams can only be decoded whole into a cv::Mat");
+                }
+                s.filter = static_cast<Filter>(data[5]);
+                s.flags = data[6];
+                s.data += container::HEADER_SIZE;
+                s.size -= container::HEADER_SIZE;
+                if (s.flags & container::flags::DICTIONARY) {
+                    if (s.size < sizeof(uint32_t)) {
+                        throw std::runtime_error("Not a QOI image");
+                    }
+                    auto id = boost::endian::load_big_u32(s.data);
+                    s.dictionary = Dictionary::find(id);
+                    if (!s.dictionary) {
+                        throw std::runtime_error("Unknown cvqoi dictionary " + std::to_string(id));
+                    }
+                    s.data += sizeof(id);
+                    s.size -= sizeof(id);
+                }
+            }
+            if (s.size < qoi::HEADER_SIZE + (complete ? qoi::EOS.size() : 0)
+                || !std::equal(qoi::MAGIC.begin(), qoi::MAGIC.end(), s.data)) {
+                throw std::runtime_error("Not a QOI image");
+            }
+            auto &h = s.header;
+            h.width = boost::endian::load_big_u32(s.data + 4);
+            h.height = boost::endian::load_big_u32(s.data + 8);
+            h.channels = s.data[12];
+            h.colorspace = s.data[13];
+            if (h.channels != 3 && h.channels != 4) {
+                throw std::runtime_error("QOI image must have 3 or 4 channels");
+            }
+            checkDimensions(h.width, h.height);
+            return s;
+        }
+
+        // Same limits as the reference decoder, so a corrupt header can not ask for a huge or
+        // negative sized cv::Mat.
+        static void checkDimensions(uint32_t width, uint32_t height) {
+            constexpr uint32_t maxSide = static_cast<uint32_t>(std::numeric_limits<int>::max());
+            if (width == 0 || height == 0 || width > maxSide || height > maxSide 
+                || height >= qoi::PIXELS_MAX / width) {
+                throw std::runtime_error("QOI image dimensions are out of range");
+            }
+        }
+
+        // Both planes are decoded in parallel and merged into mat.
+        static void decodeWide(const uint8_t *data, size_t size, cv::Mat &mat) {
+            auto *p = data + container::HEADER_SIZE;
+            size -= container::HEADER_SIZE;
+            if (size < wide::HEADER_SIZE) {
+                throw std::runtime_error("Not a QOI image");
+            }
+            int channels = p[0];
+            auto width = boost::endian::load_big_u32(p + 4);
+            auto height = boost::endian::load_big_u32(p + 8);
+            auto highSize = boost::endian::load_big_u64(p + 12);
+            p += wide::HEADER_SIZE;
+            size -= wide::HEADER_SIZE;
+            if (channels < 1 || channels > 4 || highSize > size) {
+                throw std::runtime_error("Corrupt 16-bit cvqoi header");
+            }
+            checkDimensions(width, height);
+            auto shape = wide::planeShape(width, channels);
+            size_t rowSize = static_cast<size_t>(shape.first) * shape.second;
+            auto decodePlane = [&](const uint8_t *plane, size_t planeSize) {
+                auto h = header(plane, planeSize);
+                if (h.width != shape.first || h.height != height || h.channels != shape.second) {
+                    throw std::runtime_error("16-bit cvqoi plane does not match the image");
+                }
+                std::vector<uint8_t> out(rowSize * height);
+                decode(plane, planeSize, out.data(), rowSize);
+                return out;
+            };
+            auto high = std::async(std::launch::async, decodePlane, p, static_cast<size_t>(highSize));
+            auto low = decodePlane(p + highSize, size - highSize);
+            auto highPlane = high.get();
+
+            mat.create(static_cast<int>(height), static_cast<int>(width), CV_16UC(channels));
+            size_t samples = static_cast<size_t>(width) * channels;
+            for (uint32_t r = 0; r < height; ++r) {
+                auto *dst = mat.ptr<uint16_t>(static_cast<int>(r));
+                auto *hi = highPlane.data() + r * rowSize;
+                auto *lo = low.data() + r * rowSize;
+                for (size_t i = 0; i < samples; ++i) {
+                    dst[i] = static_cast<uint16_t>((hi[i] << 8) | lo[i]);
+                }
+            }
+        }
+
+        template<int channels, bool box>
+        static void decodeScaled(const Stream &s, uint32_t scale, cv::Mat &mat) {
+            auto &h = s.header;
+            State state(s);
+            size_t offset = qoi::HEADER_SIZE;
+            size_t end = s.size - qoi::EOS.size();
+            std::vector<uint8_t> row(h.width * channels), above(s.filter == Filter::Vertical ? row.size() : 0);
+            std::vector<uint32_t> sums(box ? mat.cols * channels : 0);
+            // Interlaced rows are only complete at the end, those are decoded up front.
+            bool interlaced = s.flags & container::flags::INTERLACED;
+            std::vector<uint8_t> image(interlaced ? h.height * row.size() : 0);
+            if (interlaced) {
+                int passes = 0;
+                decodeInterlaced<channels>(s, end, state, image.data(), row.size(), false, passes);
+            }
+            for (uint32_t r = 0; r < h.height; ++r) {
+                const uint8_t *full;
+                if (interlaced) {
+                    full = image.data() + r * row.size();
+                }
+                else {
+                    decodeRow<channels>(s, end, offset, state, row.data(), above.data());
+                    if (s.filter == Filter::Vertical) {
+                        above.swap(row);
+                    }
+                    full = s.filter == Filter::Vertical ? above.data() : row.data();
+                }
+                auto blockRow = r % scale;
+                auto *out = mat.ptr<uint8_t>(static_cast<int>(r / scale));
+                if constexpr (box) {
+                    for (int oc = 0; oc < mat.cols; ++oc) {
+                        auto blockCols = std::min<uint32_t>(scale, h.width - oc * scale);
+                        for (uint32_t j = 0; j < blockCols; ++j) {
+                            for (int k = 0; k < channels; ++k) {
+                                sums[oc * channels + k] += full[(oc * scale + j) * channels + k];
+                            }
+                        }
+                    }
+                    if (blockRow == scale - 1 || r == h.height - 1) {
+                        for (int oc = 0; oc < mat.cols; ++oc) {
+                            auto blockCols = std::min<uint32_t>(scale, h.width - oc * scale);
+                            auto count = blockCols * (blockRow + 1);
+                            for (int k = 0; k < channels; ++k) {
+                                auto &sum = sums[oc * channels + k];
+                                out[oc * channels + k] = static_cast<uint8_t>((sum + count / 2) / count);
+                                sum = 0;
+                            }
+                        }
+                    }
+                }
+                else if (blockRow == 0) {
+                    for (int oc = 0; oc < mat.cols; ++oc) {
+                        std::memcpy(out + oc * channels, full + oc * scale * channels, channels);
+                    }
+                }
+            }
+        }
+
+        struct State {
+            explicit State(const Stream &s) {
+                arr.fill({0, 0, 0, 0});
+                previousPixel = {0, 0, 0, 255};
+                if (s.dictionary) {
+                    arr = s.dictionary->index;
+                    previousPixel = s.dictionary->previous;
+                    arr[util::hash(previousPixel)] = previousPixel;
+                }
+                if (s.flags & container::flags::LARGE_INDEX) {
+                    large.assign(largeindex::SIZE, {0, 0, 0, 0});
+                }
+            }
+            std::array<Pixel, 64> arr;
+            std::vector<Pixel> large;
+            Pixel previousPixel;
+            uint8_t runningPixCnt{0};
+        };
+
+        // Moves to the last checkpoint at or above row first, if the stream has a row index.
+        static void seek(const Stream &s, uint32_t first, State &state, size_t &offset, uint64_t &pixel) {
+            auto *data = s.data;
+            auto size = s.size;
+            auto minSize = qoi::HEADER_SIZE + qoi::EOS.size() + rowindex::FOOTER_SIZE;
+            if (size < minSize || !std::equal(rowindex::MAGIC.begin(), rowindex::MAGIC.end(), 
+                                              data + size - rowindex::MAGIC.size())) {
+                return;
+            }
+            auto *footer = data + size - rowindex::FOOTER_SIZE;
+            uint32_t interval = boost::endian::load_big_u32(footer);
+            uint32_t count = boost::endian::load_big_u32(footer + 4);
+            if (interval == 0 || count == 0 
+                || (size - minSize) / rowindex::CHECKPOINT_SIZE < count) {
+                return;
+            }
+            uint32_t k = std::min(first / interval, count);
+            if (k == 0) {
+                return;
+            }
+            auto *cp = footer - (count - (k - 1)) * rowindex::CHECKPOINT_SIZE;
+            uint64_t cpOffset = boost::endian::load_big_u64(cp);
+            if (cpOffset < qoi::HEADER_SIZE || cpOffset > size) {
+                throw std::runtime_error("Corrupt QOI row index");
+            }
+            offset = cpOffset;
+            state.runningPixCnt = cp[8];
+            // Stored pixels are RGBA like the chunks, the pending run is part of the rows above.
+            auto fromRGBA = [](const uint8_t *p) { return Pixel{p[2], p[1], p[0], p[3]}; };
+            state.previousPixel = fromRGBA(cp + 9);
+            for (size_t i = 0; i < state.arr.size(); ++i) {
+                state.arr[i] = fromRGBA(cp + 13 + i * 4);
+            }
+            pixel = static_cast<uint64_t>(k) * interval * s.header.width - state.runningPixCnt;
+            state.runningPixCnt = 0;
+        }
+
+        template<int channels>
+        static void decodeRange(const Stream &s, uint32_t first, uint32_t last,
+                                State &state, size_t offset, uint64_t pixel, uint8_t *dst, size_t stride) {
+            auto &h = s.header;
+            // The last 8 bytes of the chunk data are always EOS so no chunk can reach into them.
+            size_t end = s.size - qoi::EOS.size();
+            std::vector<uint8_t> above;
+            if (s.filter == Filter::Vertical) {
+                // pixel is 0 here, rebuild the rows above the band one at a time.
+                std::vector<uint8_t> row(h.width * channels);
+                above.resize(row.size());
+                for (uint32_t r = 0; r < first; ++r) {
+                    decodeRow<channels>(s, end, offset, state, row.data(), above.data());
+                    above.swap(row);
+                }
+            }
+            else {
+                uint64_t begin = static_cast<uint64_t>(first) * h.width;
+                for (; pixel < begin; ++pixel) {
+                    nextPixel(s.data, end, offset, state);
+                }
+            }
+            for (uint32_t r = first; r < last; ++r) {
+                auto *row = dst + (r - first) * stride;
+                decodeRow<channels>(s, end, offset, state, row, r == first ? above.data() : row - stride);
+            }
+        }
+
+        // Decodes the passes of an interlaced stream into dst, counting complete ones in passes. With
+        // fill every pixel also covers its block, see adam7.
+        template<int channels>
+        static void decodeInterlaced(const Stream &s, size_t end, State &state, uint8_t *dst, size_t stride, 
+                                     bool fill, int &passes) {
+            auto &h = s.header;
+            size_t offset = qoi::HEADER_SIZE;
+            for (const auto &p : adam7::PASSES) {
+                for (uint32_t y = p.y0; y < h.height && p.x0 < h.width; y += p.dy) {
+                    auto blockHeight = std::min(p.blockHeight, h.height - y);
+                    for (uint32_t x = p.x0; x < h.width; x += p.dx) {
+                        nextPixel(s.data, end, offset, state);
+                        auto px = state.previousPixel;
+                        if (s.filter == Filter::YCoCgR) {
+                            ycocg::inverse(px[0], px[1], px[2]);
+                        }
+                        auto blockWidth = fill ? std::min(p.blockWidth, h.width - x) : 1;
+                        for (uint32_t by = 0; by < (fill ? blockHeight : 1); ++by) {
+                            auto *out = dst + (y + by) * stride + x * channels;
+                            for (uint32_t bx = 0; bx < blockWidth; ++bx) {
+                                std::memcpy(out + bx * channels, &px, channels);
+                            }
+                        }
+                    }
+                }
+                ++passes;
+            }
+        }
+
+        // Decodes the next width pixels into row and undoes the pre-filter. above is the
+        // previous decoded row, only read for Filter::Vertical.
+        template<int channels>
+        static void decodeRow(const Stream &s, size_t end, size_t &offset, State &state, 
+                              uint8_t *row, const uint8_t *above) {
+            auto width = s.header.width;
+            for (uint32_t c = 0; c < width; ++c) {
+                nextPixel(s.data, end, offset, state);
+                std::memcpy(row + c * channels, &state.previousPixel, channels);
+            }
+            if (s.filter == Filter::YCoCgR) {
+                for (uint32_t c = 0; c < width; ++c) {
+                    auto *p = row + c * channels;
+                    ycocg::inverse(p[0], p[1], p[2]);
+                }
+            }
+            else if (s.filter == Filter::Vertical) {
+                for (size_t i = 0; i < static_cast<size_t>(width) * channels; ++i) {
+                    row[i] += above[i];
+                }
+            }
+        }
+
+        static void nextPixel(const uint8_t *data, size_t end, size_t &offset, State &state) {
+            auto &px = state.previousPixel;
+            if (state.runningPixCnt > 0) {
+                --state.runningPixCnt;
+                return;
+            }
+            if (offset >= end) {
+                throw std::runtime_error("QOI stream is truncated");
+            }
+            uint8_t b1 = data[offset++];
+            if (b1 == rgb::TAG || b1 == rgba::TAG) {
+                size_t n = b1 == rgb::TAG ? 3 : 4;
+                if (offset + n > end) {
+                    throw std::runtime_error("QOI stream is truncated");
+                }
+                util::red(px) = data[offset];
+                util::green(px) = data[offset + 1];
+                util::blue(px) = data[offset + 2];
+                if (n == 4) {
+                    util::alpha(px) = data[offset + 3];
+                }
+                offset += n;
+            }
+            else if (b1 >= largeindex::TAG && !state.large.empty()) {
+                if (offset >= end) {
+                    throw std::runtime_error("QOI stream is truncated");
+                }
+                px = state.large[((b1 - largeindex::TAG) << 8) | data[offset++]];
+            }
+            else if ((b1 & 0xc0) == index::TAG) {
+                px = state.arr[b1];
+            }
+            else if ((b1 & 0xc0) == diff::TAG) {
+                util::red(px) += ((b1 >> 4) & 0x03) - diff::BIAS;
+                util::green(px) += ((b1 >> 2) & 0x03) - diff::BIAS;
+                util::blue(px) += (b1 & 0x03) - diff::BIAS;
+            }
+            else if ((b1 & 0xc0) == luma::TAG) {
+                if (offset >= end) {
+                    throw std::runtime_error("QOI stream is truncated");
+                }
+                uint8_t b2 = data[offset++];
+                int dg = (b1 & 0x3f) - luma::green::BIAS;
+                util::red(px) += dg - luma::red_blue::BIAS + ((b2 >> 4) & 0x0f);
+                util::green(px) += dg;
+                util::blue(px) += dg - luma::red_blue::BIAS + (b2 & 0x0f);
+            }
+            else {
+                state.runningPixCnt = b1 & 0x3f;
+            }
+            state.arr[util::hash(px)] = px;
+            if (!state.large.empty()) {
+                state.large[util::largeHash(px)] = px;
+            }
+        }
+
+    private:
+        cv::Mat &mat;
+        bool validateChecksum{false};
+    };
 };
\ No newline at end of file
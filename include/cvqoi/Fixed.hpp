@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+
+namespace cvqoi
+{
+    // Encoding for small tiles whose size is known at compile time, where the Encoder's per image
+    // setup (stream, header writes, table init) costs as much as the pixels. Output is the same
+    // standard QOI the Encoder writes without options, written straight to memory.
+
+    // Worst case encoded size, every pixel a full rgb/rgba chunk.
+    template<uint32_t W, uint32_t H, int Channels>
+    constexpr size_t fixedMaxSize = qoi::HEADER_SIZE + static_cast<size_t>(W) * H * (Channels + 1) + qoi::EOS.size();
+
+    template<uint32_t W, uint32_t H, int Channels>
+    using FixedBuffer = std::array<uint8_t, fixedMaxSize<W, H, Channels>>;
+
+    template<uint32_t W, uint32_t H, int Channels>
+    constexpr std::array<uint8_t, qoi::HEADER_SIZE> fixedHeader() {
+        return {static_cast<uint8_t>(qoi::MAGIC[0]), static_cast<uint8_t>(qoi::MAGIC[1]),
+                static_cast<uint8_t>(qoi::MAGIC[2]), static_cast<uint8_t>(qoi::MAGIC[3]),
+                static_cast<uint8_t>(W >> 24), static_cast<uint8_t>(W >> 16), static_cast<uint8_t>(W >> 8), static_cast<uint8_t>(W),
+                static_cast<uint8_t>(H >> 24), static_cast<uint8_t>(H >> 16), static_cast<uint8_t>(H >> 8), static_cast<uint8_t>(H),
+                static_cast<uint8_t>(Channels), 1};
+    }
+
+    // Encodes a W x H tile of interleaved BGR/A pixels, rows stride bytes apart, into out which
+    // must hold fixedMaxSize bytes. Returns the encoded size.
+    template<uint32_t W, uint32_t H, int Channels>
+    size_t encodeFixed(const uint8_t *data, size_t stride, uint8_t *out) {
+        static_assert(W > 0 && H > 0, "Tiles must have at least one pixel.");
+        static_assert(Channels == 3 || Channels == 4, "Tiles must have 3 or 4 channels.");
+        constexpr bool hasAlpha = Channels == 4;
+        using Pixel = PixelType<hasAlpha>;
+        using SignedPixel = SignedPixelType<hasAlpha>;
+        using util = cvqoi::util<Pixel, SignedPixel, hasAlpha>;
+
+        constexpr auto header = fixedHeader<W, H, Channels>();
+        std::memcpy(out, header.data(), header.size());
+        auto *p = out + header.size();
+
+        // Same start state as the Encoder, see Encoder::reset.
+        std::array<Pixel, 64> arr{};
+        Pixel previousPixel{};
+        if constexpr (hasAlpha) {
+            util::alpha(previousPixel) = 255;
+        }
+        else {
+            arr[util::hash(previousPixel)] = Pixel::all(255);
+        }
+        uint8_t run = 0;
+        for (uint32_t r = 0; r < H; ++r) {
+            auto *row = reinterpret_cast<const Pixel*>(data + r * stride);
+            for (uint32_t c = 0; c < W; ++c) {
+                const auto &px = row[c];
+                if (px == previousPixel) {
+                    if (++run == run::UPPER_LIMIT || (r == H - 1 && c == W - 1)) {
+                        *p++ = run::TAG | (run - run::BIAS);
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0) {
+                    *p++ = run::TAG | (run - run::BIAS);
+                    run = 0;
+                }
+                auto idx = util::hash(px);
+                if (arr[idx] == px) {
+                    *p++ = index::TAG | idx;
+                    previousPixel = px;
+                    continue;
+                }
+                arr[idx] = px;
+
+                SignedPixel dp, lumaDp;
+                for (int i = 0; i < Channels; ++i) {
+                    dp[i] = static_cast<int8_t>(px[i] - previousPixel[i]);
+                }
+                if (hasAlpha && dp[Channels - 1] != 0) {
+                    *p++ = rgba::TAG;
+                    *p++ = util::red(px);
+                    *p++ = util::green(px);
+                    *p++ = util::blue(px);
+                    *p++ = px[Channels - 1];
+                }
+                else if (util::isInDiffRange(dp)) {
+                    *p++ = diff::TAG | ((util::red(dp) + diff::BIAS) << 4)
+                                     | ((util::green(dp) + diff::BIAS) << 2)
+                                     | (util::blue(dp) + diff::BIAS);
+                }
+                else if (util::isInLumaRange(dp, lumaDp)) {
+                    *p++ = luma::TAG | (util::green(lumaDp) + luma::green::BIAS);
+                    *p++ = ((util::red(lumaDp) + luma::red_blue::BIAS) << 4) | (util::blue(lumaDp) + luma::red_blue::BIAS);
+                }
+                else {
+                    *p++ = rgb::TAG;
+                    *p++ = util::red(px);
+                    *p++ = util::green(px);
+                    *p++ = util::blue(px);
+                }
+                previousPixel = px;
+            }
+        }
+        std::memcpy(p, qoi::EOS.data(), qoi::EOS.size());
+        return static_cast<size_t>(p - out) + qoi::EOS.size();
+    }
+
+    // Same into a stack buffer:
+    //
+    //     cvqoi::FixedBuffer<16, 16, 3> buf;
+    //     auto size = cvqoi::encodeFixed<16, 16, 3>(tile.data, tile.step[0], buf);
+    template<uint32_t W, uint32_t H, int Channels>
+    size_t encodeFixed(const uint8_t *data, size_t stride, FixedBuffer<W, H, Channels> &out) {
+        return encodeFixed<W, H, Channels>(data, stride, out.data());
+    }
+
+    // Encodes count tiles back to back, appending to out. ends receives the offset in out just
+    // past each tile, so tile i spans [ends[i - 1], ends[i]).
+    template<uint32_t W, uint32_t H, int Channels>
+    void encodeFixedBatch(const uint8_t *const *tiles, size_t count, size_t stride,
+                          std::vector<uint8_t> &out, std::vector<size_t> &ends) {
+        constexpr auto maxSize = fixedMaxSize<W, H, Channels>;
+        size_t used = out.size();
+        ends.reserve(ends.size() + count);
+        for (size_t i = 0; i < count; ++i) {
+            if (out.size() - used < maxSize) {
+                out.resize(std::max(out.size() * 2, used + maxSize));
+            }
+            used += encodeFixed<W, H, Channels>(tiles[i], stride, out.data() + used);
+            ends.push_back(used);
+        }
+        out.resize(used);
+    }
+};
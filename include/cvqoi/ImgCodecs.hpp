@@ -0,0 +1,237 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "cvqoi/CVQoi.hpp"
+
+// POSIX only, kept out of CVQoi.hpp so the core header stays portable.
+
+namespace cvqoi
+{
+    // Drop-ins for cv::imwrite and cv::imread that always write QOI, whatever the extension, and
+    // imencode / imdecode in the same spirit. Those have no extension argument and take byte
+    // vectors or pointers instead of InputArray. 8-bit images with 3 or 4 channels are encoded as
+    // they are, 1 and 2 channels are expanded to BGR/BGRA first, CV_16U goes through WideEncoder.
+    // Output goes into one buffer sized with maxSize(), files are written and read with one
+    // write/read call.
+    //
+    //     cvqoi::imwrite("frame.qoi", mat);
+    //     auto gray = cvqoi::imread("frame.qoi", cv::IMREAD_GRAYSCALE);
+    namespace imgcodecs {
+        template<typename E>
+        void encodeInto(const E &e, std::vector<uint8_t> &buf) {
+            buf.resize(static_cast<size_t>(e.maxSize()));
+            FixedBuf fb(reinterpret_cast<char*>(buf.data()), buf.size());
+            std::ostream os(&fb);
+            os << e;
+            buf.resize(fb.size());
+        }
+
+        // Converts between 1, 2, 3 and 4 channel layouts of the same depth. Gray from color uses
+        // the same fixed point weights as cv::COLOR_BGR2GRAY, color from gray repeats it.
+        template<typename T>
+        cv::Mat toChannels(const cv::Mat &src, int channels) {
+            cv::Mat dst(src.rows, src.cols, CV_MAKETYPE(src.depth(), channels));
+            int sc = src.channels();
+            for (int r = 0; r < src.rows; ++r) {
+                auto *s = src.ptr<T>(r);
+                auto *d = dst.ptr<T>(r);
+                for (int c = 0; c < src.cols; ++c, s += sc, d += channels) {
+                    if (channels == 1) {
+                        d[0] = sc < 3 ? s[0] : static_cast<T>((s[0] * 1868u + s[1] * 9617u + s[2] * 4899u + 8192u) >> 14);
+                        continue;
+                    }
+                    for (int i = 0; i < 3; ++i) {
+                        d[i] = s[sc < 3 ? 0 : i];
+                    }
+                    if (channels == 4) {
+                        d[3] = sc == 2 || sc == 4 ? s[sc - 1] : static_cast<T>(~T(0));
+                    }
+                }
+            }
+            return dst;
+        }
+
+        // Rounded average of each scale x scale block, the same as the Box mode of decodeScaled,
+        // for the reduced flags on streams decodeScaled can not handle.
+        template<typename T>
+        cv::Mat reduce(const cv::Mat &src, int scale) {
+            cv::Mat dst((src.rows + scale - 1) / scale, (src.cols + scale - 1) / scale, src.type());
+            int channels = src.channels();
+            for (int r = 0; r < dst.rows; ++r) {
+                auto *d = dst.ptr<T>(r);
+                int blockRows = std::min(scale, src.rows - r * scale);
+                for (int c = 0; c < dst.cols; ++c) {
+                    int blockCols = std::min(scale, src.cols - c * scale);
+                    uint32_t count = static_cast<uint32_t>(blockRows * blockCols);
+                    for (int k = 0; k < channels; ++k) {
+                        uint32_t sum = 0;
+                        for (int y = 0; y < blockRows; ++y) {
+                            auto *s = src.ptr<T>(r * scale + y) + c * scale * channels + k;
+                            for (int x = 0; x < blockCols; ++x) {
+                                sum += s[x * channels];
+                            }
+                        }
+                        d[c * channels + k] = static_cast<T>((sum + count / 2) / count);
+                    }
+                }
+            }
+            return dst;
+        }
+
+        // IMREAD_REDUCED_* are the grayscale or color flag plus 16, 32 or 64.
+        inline int reduction(int flags) {
+            if (flags == cv::IMREAD_UNCHANGED) {
+                return 1;
+            }
+            return flags & 64 ? 8 : flags & 32 ? 4 : flags & 16 ? 2 : 1;
+        }
+
+        // Depth and channels the way cv::imread picks them from flags.
+        inline void convert(cv::Mat &mat, int flags) {
+            if (flags == cv::IMREAD_UNCHANGED) {
+                return;
+            }
+            if (mat.depth() == CV_16U && !(flags & cv::IMREAD_ANYDEPTH)) {
+                cv::Mat narrow;
+                mat.convertTo(narrow, CV_MAKETYPE(CV_8U, mat.channels()), 1.0 / 256);
+                mat = narrow;
+            }
+            int channels = flags & cv::IMREAD_ANYCOLOR ? (mat.channels() >= 3 ? 3 : 1)
+                                                       : (flags & cv::IMREAD_COLOR ? 3 : 1);
+            if (mat.channels() != channels) {
+                mat = mat.depth() == CV_16U ? toChannels<uint16_t>(mat, channels) : toChannels<uint8_t>(mat, channels);
+            }
+        }
+
+        inline bool writeFile(const std::string &path, const uint8_t *data, size_t size) {
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                return false;
+            }
+            // Loops only when the kernel takes less than everything.
+            while (size > 0) {
+                auto n = ::write(fd, data, size);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    ::close(fd);
+                    return false;
+                }
+                data += n;
+                size -= static_cast<size_t>(n);
+            }
+            return ::close(fd) == 0;
+        }
+
+        inline bool readFile(const std::string &path, std::vector<uint8_t> &buf) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            buf.resize(static_cast<size_t>(st.st_size));
+            size_t done = 0;
+            while (done < buf.size()) {
+                auto n = ::read(fd, buf.data() + done, buf.size() - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                done += static_cast<size_t>(n);
+            }
+            ::close(fd);
+            buf.resize(done);
+            return true;
+        }
+    }
+
+    // buf keeps the capacity of the worst case, reusing it for frames of the same size does not
+    // allocate again. Throws std::invalid_argument for depths and channel counts QOI can not hold.
+    inline bool imencode(const cv::Mat &mat, std::vector<uint8_t> &buf) {
+        if (mat.empty()) {
+            throw std::invalid_argument("Can not encode an empty image");
+        }
+        if (mat.channels() > 4 || (mat.depth() != CV_8U && mat.depth() != CV_16U)) {
+            throw std::invalid_argument("QOI images must have 1 to 4 channels of 8 or 16 bits");
+        }
+        if (mat.depth() == CV_16U) {
+            imgcodecs::encodeInto(WideEncoder(mat), buf);
+        }
+        else if (mat.channels() == 4) {
+            imgcodecs::encodeInto(Encoder<true>(mat), buf);
+        }
+        else if (mat.channels() == 3) {
+            imgcodecs::encodeInto(Encoder<>(mat), buf);
+        }
+        else if (mat.channels() == 2) {
+            imgcodecs::encodeInto(Encoder<true>(imgcodecs::toChannels<uint8_t>(mat, 4)), buf);
+        }
+        else {
+            imgcodecs::encodeInto(Encoder<>(imgcodecs::toChannels<uint8_t>(mat, 3)), buf);
+        }
+        return true;
+    }
+
+    // Like cv::imdecode, an empty cv::Mat if data is not a QOI image cvqoi can decode.
+    inline cv::Mat imdecode(const uint8_t *data, size_t size, int flags = cv::IMREAD_COLOR) {
+        cv::Mat mat;
+        try {
+            auto scale = imgcodecs::reduction(flags);
+            bool wide = size >= container::HEADER_SIZE && std::equal(container::MAGIC.begin(), container::MAGIC.end(), data)
+                        && (data[6] & container::flags::WIDE);
+            if (scale > 1 && !wide) {
+                Decoder::decodeScaled(data, size, static_cast<uint32_t>(scale), mat);
+            }
+            else {
+                Decoder::decode(data, size, mat);
+                if (scale > 1) {
+                    mat = mat.depth() == CV_16U ? imgcodecs::reduce<uint16_t>(mat, scale)
+                                                : imgcodecs::reduce<uint8_t>(mat, scale);
+                }
+            }
+        }
+        catch (const std::exception&) {
+            return {};
+        }
+        imgcodecs::convert(mat, flags);
+        return mat;
+    }
+
+    inline cv::Mat imdecode(const std::vector<uint8_t> &buf, int flags = cv::IMREAD_COLOR) {
+        return imdecode(buf.data(), buf.size(), flags);
+    }
+
+    // params are accepted so calls to cv::imwrite compile unchanged, there is nothing to tune.
+    inline bool imwrite(const std::string &path, const cv::Mat &mat, const std::vector<int> &params = {}) {
+        (void)params;
+        std::vector<uint8_t> buf;
+        imencode(mat, buf);
+        return imgcodecs::writeFile(path, buf.data(), buf.size());
+    }
+
+    // Like cv::imread, an empty cv::Mat if the file can not be read or decoded.
+    inline cv::Mat imread(const std::string &path, int flags = cv::IMREAD_COLOR) {
+        std::vector<uint8_t> buf;
+        if (!imgcodecs::readFile(path, buf)) {
+            return {};
+        }
+        return imdecode(buf, flags);
+    }
+};
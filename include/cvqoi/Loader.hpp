@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/Archive.hpp"
+
+namespace cvqoi
+{
+    // Decodes a list of images on a pool of threads ahead of a single consumer, in list order.
+    // Decoded images live in prefetch reusable cv::Mat slots, so memory stays fixed however
+    // long the list is.
+    //
+    //     cvqoi::Loader loader(files, 4, 16);
+    //     while (auto *image = loader.next()) {
+    //         //Use *image, it is valid until the next call to next()
+    //     }
+    class Loader
+    {
+    public:
+        // Gives the encoded bytes of image i, scratch can be used as storage for them.
+        using Fetch = std::function<std::pair<const uint8_t*, size_t>(size_t i, std::vector<uint8_t> &scratch)>;
+
+        struct Stats {
+            size_t queueDepth;       // Decoded images waiting for the consumer.
+            size_t consumed;
+            double stallSeconds;     // Total time next() waited for a decode.
+            double imagesPerSecond;  // Consumed images since construction.
+        };
+
+        Loader(Fetch fetch, size_t count, size_t threads = std::thread::hardware_concurrency(), size_t prefetch = 8)
+            : Loader(count, prefetch) {
+            this->fetch = std::move(fetch);
+            spawn(threads);
+        }
+
+        Loader(std::vector<std::string> files, size_t threads = std::thread::hardware_concurrency(), size_t prefetch = 8)
+            : Loader(files.size(), prefetch) {
+            paths = std::move(files);
+            fetch = [this](size_t i, std::vector<uint8_t> &scratch) {
+                std::ifstream is(paths[i], std::ios::binary | std::ios::ate);
+                if (!is) {
+                    throw std::runtime_error("Could not open " + paths[i]);
+                }
+                scratch.resize(static_cast<size_t>(is.tellg()));
+                is.seekg(0);
+                is.read(reinterpret_cast<char*>(scratch.data()), scratch.size());
+                return std::make_pair<const uint8_t*, size_t>(scratch.data(), scratch.size());
+            };
+            spawn(threads);
+        }
+
+        // The archive must outlive the Loader. Images are decoded straight out of its mapping.
+        Loader(const ArchiveReader &archive, std::vector<size_t> indices, 
+               size_t threads = std::thread::hardware_concurrency(), size_t prefetch = 8)
+            : Loader(indices.size(), prefetch) {
+            this->indices = std::move(indices);
+            fetch = [&archive, this](size_t i, std::vector<uint8_t>&) { 
+                return archive.data(this->indices[i]); 
+            };
+            spawn(threads);
+        }
+
+        Loader(const Loader&) = delete;
+        Loader& operator=(const Loader&) = delete;
+
+        ~Loader() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            slotFreed.notify_all();
+            for (auto &w : workers) {
+                w.join();
+            }
+        }
+
+        // Returns the next image in list order or nullptr once all are consumed. The image
+        // returned by the previous call goes back to the pool. Decode errors are rethrown here.
+        const cv::Mat* next() {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (holding) {
+                holding = false;
+                ++released;
+                slotFreed.notify_all();
+            }
+            if (consumed == count) {
+                return nullptr;
+            }
+            auto &slot = slots[consumed % slots.size()];
+            if (!slot.ready) {
+                CVQOI_TRACE_SPAN("stall");
+                auto waitStart = std::chrono::steady_clock::now();
+                slotReady.wait(lock, [&] { return slot.ready; });
+                stall += std::chrono::steady_clock::now() - waitStart;
+            }
+            slot.ready = false;
+            --ready;
+            ++consumed;
+            holding = true;
+            if (slot.error) {
+                std::rethrow_exception(std::exchange(slot.error, nullptr));
+            }
+            return &slot.mat;
+        }
+
+        Stats stats() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return {ready, consumed, std::chrono::duration<double>(stall).count(), consumed / elapsed.count()};
+        }
+
+    private:
+        struct Slot {
+            cv::Mat mat;
+            bool ready{false};
+            std::exception_ptr error;
+        };
+
+        Loader(size_t count, size_t prefetch) 
+            : count(count), slots(std::max<size_t>(prefetch, 1)), start(std::chrono::steady_clock::now()) {}
+
+        void spawn(size_t threads) {
+            threads = std::max<size_t>(threads, 1);
+            workers.reserve(threads);
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([this] { work(); });
+            }
+        }
+
+        void work() {
+            std::vector<uint8_t> scratch;
+            for (;;) {
+                auto i = nextItem++;
+                if (i >= count) {
+                    return;
+                }
+                auto &slot = slots[i % slots.size()];
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slotFreed.wait(lock, [&] { return stop || i < released + slots.size(); });
+                    if (stop) {
+                        return;
+                    }
+                }
+                // The slot is ours until ready is set, nobody else touches it.
+                try {
+                    std::pair<const uint8_t*, size_t> encoded;
+                    {
+                        CVQOI_TRACE_SPAN("fetch");
+                        encoded = fetch(i, scratch);
+                    }
+                    Decoder::decode(encoded.first, encoded.second, slot.mat);
+                }
+                catch (...) {
+                    slot.error = std::current_exception();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slot.ready = true;
+                    ++ready;
+                }
+                slotReady.notify_all();
+            }
+        }
+
+        Fetch fetch;
+        size_t count;
+        std::vector<std::string> paths;
+        std::vector<size_t> indices;
+        std::vector<Slot> slots;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> nextItem{0};
+
+        mutable std::mutex mutex;
+        std::condition_variable slotFreed;
+        std::condition_variable slotReady;
+        bool stop{false};
+        bool holding{false};
+        size_t released{0};
+        size_t consumed{0};
+        size_t ready{0};
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::duration stall{};
+    };
+};
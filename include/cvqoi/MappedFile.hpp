@@ -0,0 +1,85 @@
+#pragma once
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// POSIX only, kept out of CVQoi.hpp so the core header stays portable.
+
+namespace cvqoi
+{
+    // Read-only mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string &path) {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "Could not open " + path);
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                auto err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "Could not stat " + path);
+            }
+            length = static_cast<size_t>(st.st_size);
+            if (length > 0) {
+                void *p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED) {
+                    auto err = errno;
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(), "Could not map " + path);
+                }
+                map = static_cast<const uint8_t*>(p);
+            }
+        }
+
+        MappedFile(MappedFile &&other) noexcept 
+            : fd(std::exchange(other.fd, -1)), map(std::exchange(other.map, nullptr)), 
+              length(std::exchange(other.length, 0)) {}
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile& operator=(MappedFile&&) = delete;
+
+        ~MappedFile() {
+            if (map) {
+                ::munmap(const_cast<uint8_t*>(map), length);
+            }
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        const uint8_t* data() const {
+            return map;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        // Passes advice for [offset, offset + len) to madvise, the range is widened to whole pages.
+        void advise(size_t offset, size_t len, int advice) const {
+            static const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            if (!map || offset >= length) {
+                return;
+            }
+            auto begin = offset / pageSize * pageSize;
+            auto end = std::min(offset + len, length);
+            ::madvise(const_cast<uint8_t*>(map) + begin, end - begin, advice);
+        }
+
+    private:
+        int fd{-1};
+        const uint8_t *map{nullptr};
+        size_t length{0};
+    };
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include "cvqoi/MappedFile.hpp"
+
+namespace cvqoi
+{
+    // A cvqoi::RowSource over an uncompressed interleaved BGR/A file, for out-of-core encoding:
+    //
+    //     cvqoi::MappedRawSource src("mosaic.raw", width, height, 3);
+    //     os << cvqoi::Encoder<>(std::cref(src), width, height);
+    //
+    // Rows are copied out of the mapping on the Encoder's prefetch thread and the pages are dropped
+    // right after, so the resident set stays around two bands no matter how large the file is.
+    class MappedRawSource
+    {
+    public:
+        MappedRawSource(const std::string &path, uint32_t width, uint32_t height, int channels, 
+                        size_t stride = 0, size_t offset = 0)
+            : file(path), offset(offset), rowBytes(static_cast<size_t>(width) * channels), 
+              stride(stride ? stride : rowBytes), height(height) {
+            if (height > 0 && offset + (height - 1) * this->stride + rowBytes > file.size()) {
+                throw std::length_error(path + " is smaller than the given image dimensions");
+            }
+            file.advise(0, file.size(), MADV_SEQUENTIAL);
+        }
+
+        void operator()(uint32_t first, uint32_t count, uint8_t *dst, size_t dstStride) const {
+            count = std::min(count, height - first);
+            auto *pixels = file.data() + offset;
+            for (uint32_t r = 0; r < count; ++r) {
+                std::memcpy(dst + r * dstStride, pixels + (first + r) * stride, rowBytes);
+            }
+            // Only whole pages below the band's end are dropped, the next band may share the last one.
+            auto begin = offset + first * stride;
+            auto end = offset + (first + count) * stride;
+            end -= end % static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            if (end > begin) {
+                file.advise(begin, end - begin, MADV_DONTNEED);
+            }
+        }
+
+    private:
+        MappedFile file;
+        size_t offset;
+        size_t rowBytes;
+        size_t stride;
+        uint32_t height;
+    };
+};
@@ -0,0 +1,500 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <boost/endian/conversion.hpp>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "cvqoi/BoundedQueue.hpp"
+#include "cvqoi/Trace.hpp"
+
+// Optional backends, define before including and link the library:
+//#define CVQOI_WITH_ZSTD
+//#define CVQOI_WITH_LZ4
+
+#ifdef CVQOI_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef CVQOI_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace cvqoi
+{
+    // General purpose compression on top of the encoded bytes, for links where size matters more
+    // than the extra pass. The output is split into blocks that are compressed on a second thread
+    // while the Encoder keeps writing.
+    //
+    // Layout: MAGIC, codec id(u8), 3 reserved bytes, block size(u32), block[], end
+    // Block: raw size(u32), compressed size(u32), payload. Equal sizes mean the block is stored.
+    // End: a raw size of 0.
+    namespace postcompress {
+        constexpr std::array<char, 4> MAGIC{'q', 'o', 'i', 'z'};
+        constexpr size_t HEADER_SIZE = 12;
+        constexpr uint32_t DEFAULT_BLOCK_SIZE = 1 << 18;
+
+        class Codec {
+        public:
+            virtual ~Codec() = default;
+            virtual uint8_t id() const = 0;
+            // Returns the compressed size, or 0 if it does not fit in capacity.
+            virtual size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) const = 0;
+            // dst has exactly rawSize bytes. Returns false on corrupt input.
+            virtual bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t rawSize) const = 0;
+        };
+
+        // Dependency free LZ77 with the LZ4 block layout: a token with literal and match length
+        // nibbles, the literals, a 16-bit little endian offset and length extension bytes.
+        class FastLZ : public Codec {
+            static constexpr size_t MIN_MATCH = 4;
+            static constexpr size_t HASH_BITS = 12;
+            static constexpr size_t MAX_OFFSET = 65535;
+            // The tail is always literals so the match finder can read 4 bytes without checks.
+            static constexpr size_t LAST_LITERALS = 5;
+
+        public:
+            static constexpr uint8_t ID = 1;
+
+            uint8_t id() const override {
+                return ID;
+            }
+
+            size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) const override {
+                std::array<uint32_t, 1 << HASH_BITS> table{};
+                size_t anchor = 0, pos = 0, out = 0;
+                size_t limit = size > LAST_LITERALS + MIN_MATCH ? size - LAST_LITERALS : 0;
+                while (pos < limit) {
+                    auto seq = load32(src + pos);
+                    auto &slot = table[hash(seq)];
+                    size_t candidate = slot;
+                    slot = static_cast<uint32_t>(pos);
+                    if (candidate >= pos || pos - candidate > MAX_OFFSET || load32(src + candidate) != seq) {
+                        ++pos;
+                        continue;
+                    }
+                    size_t len = MIN_MATCH;
+                    while (pos + len < limit && src[candidate + len] == src[pos + len]) {
+                        ++len;
+                    }
+                    if (!writeSequence(src + anchor, pos - anchor, pos - candidate, len, dst, capacity, out)) {
+                        return 0;
+                    }
+                    pos += len;
+                    anchor = pos;
+                }
+                if (!writeSequence(src + anchor, size - anchor, 0, 0, dst, capacity, out)) {
+                    return 0;
+                }
+                return out;
+            }
+
+            bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t rawSize) const override {
+                size_t in = 0, out = 0;
+                while (in < size) {
+                    uint8_t token = src[in++];
+                    size_t literals = token >> 4;
+                    if (literals == 15 && !readLength(src, size, in, literals)) {
+                        return false;
+                    }
+                    if (literals > size - in || literals > rawSize - out) {
+                        return false;
+                    }
+                    if (literals) {
+                        std::memcpy(dst + out, src + in, literals);
+                    }
+                    in += literals;
+                    out += literals;
+                    if (in == size) {
+                        break;
+                    }
+                    if (size - in < 2) {
+                        return false;
+                    }
+                    size_t offset = src[in] | (src[in + 1] << 8);
+                    in += 2;
+                    size_t len = token & 0x0f;
+                    if (len == 15 && !readLength(src, size, in, len)) {
+                        return false;
+                    }
+                    len += MIN_MATCH;
+                    if (offset == 0 || offset > out || len > rawSize - out) {
+                        return false;
+                    }
+                    // Byte by byte, matches may overlap the bytes they produce.
+                    for (size_t i = 0; i < len; ++i, ++out) {
+                        dst[out] = dst[out - offset];
+                    }
+                }
+                return out == rawSize;
+            }
+
+        private:
+            static uint32_t load32(const uint8_t *p) {
+                uint32_t v;
+                std::memcpy(&v, p, sizeof(v));
+                return v;
+            }
+
+            static size_t hash(uint32_t v) {
+                return (v * 2654435761u) >> (32 - HASH_BITS);
+            }
+
+            static bool writeLength(size_t len, uint8_t *dst, size_t capacity, size_t &out) {
+                for (; len >= 255; len -= 255) {
+                    if (out >= capacity) {
+                        return false;
+                    }
+                    dst[out++] = 255;
+                }
+                if (out >= capacity) {
+                    return false;
+                }
+                dst[out++] = static_cast<uint8_t>(len);
+                return true;
+            }
+
+            static bool readLength(const uint8_t *src, size_t size, size_t &in, size_t &len) {
+                uint8_t b;
+                do {
+                    if (in >= size) {
+                        return false;
+                    }
+                    b = src[in++];
+                    len += b;
+                } while (b == 255);
+                return true;
+            }
+
+            // A match length of 0 writes the final literals only sequence.
+            static bool writeSequence(const uint8_t *literals, size_t literalLen, size_t offset, size_t matchLen,
+                                      uint8_t *dst, size_t capacity, size_t &out) {
+                if (out >= capacity) {
+                    return false;
+                }
+                auto &token = dst[out++];
+                token = static_cast<uint8_t>(std::min<size_t>(literalLen, 15) << 4);
+                if (literalLen >= 15 && !writeLength(literalLen - 15, dst, capacity, out)) {
+                    return false;
+                }
+                if (capacity - out < literalLen) {
+                    return false;
+                }
+                if (literalLen) {
+                    std::memcpy(dst + out, literals, literalLen);
+                }
+                out += literalLen;
+                if (matchLen == 0) {
+                    return true;
+                }
+                if (capacity - out < 2) {
+                    return false;
+                }
+                dst[out++] = static_cast<uint8_t>(offset);
+                dst[out++] = static_cast<uint8_t>(offset >> 8);
+                auto extra = matchLen - MIN_MATCH;
+                token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+                return extra < 15 || writeLength(extra - 15, dst, capacity, out);
+            }
+        };
+
+        #ifdef CVQOI_WITH_ZSTD
+        class Zstd : public Codec {
+        public:
+            static constexpr uint8_t ID = 2;
+
+            explicit Zstd(int level = 1) : level(level) {}
+
+            uint8_t id() const override {
+                return ID;
+            }
+
+            size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) const override {
+                auto res = ZSTD_compress(dst, capacity, src, size, level);
+                return ZSTD_isError(res) ? 0 : res;
+            }
+
+            bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t rawSize) const override {
+                auto res = ZSTD_decompress(dst, rawSize, src, size);
+                return !ZSTD_isError(res) && res == rawSize;
+            }
+
+        private:
+            int level;
+        };
+        #endif
+
+        #ifdef CVQOI_WITH_LZ4
+        class LZ4 : public Codec {
+        public:
+            static constexpr uint8_t ID = 3;
+
+            uint8_t id() const override {
+                return ID;
+            }
+
+            size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) const override {
+                auto res = LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                                static_cast<int>(size), static_cast<int>(capacity));
+                return res > 0 ? static_cast<size_t>(res) : 0;
+            }
+
+            bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t rawSize) const override {
+                auto res = LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                               static_cast<int>(size), static_cast<int>(rawSize));
+                return res >= 0 && static_cast<size_t>(res) == rawSize;
+            }
+        };
+        #endif
+
+        // The codec a stream was written with.
+        inline std::unique_ptr<Codec> codecFor(uint8_t id) {
+            switch (id) {
+                case FastLZ::ID:
+                    return std::make_unique<FastLZ>();
+                #ifdef CVQOI_WITH_ZSTD
+                case Zstd::ID:
+                    return std::make_unique<Zstd>();
+                #endif
+                #ifdef CVQOI_WITH_LZ4
+                case LZ4::ID:
+                    return std::make_unique<LZ4>();
+                #endif
+                default:
+                    throw std::runtime_error("Post-compression codec " + std::to_string(id) + " is not available");
+            }
+        }
+    }
+
+    // Compresses everything written to stream() into os. finish() must be called at the end.
+    //
+    //     cvqoi::CompressedWriter writer(os);
+    //     writer.stream() << cvqoi::Encoder<>(mat);
+    //     writer.finish();
+    class CompressedWriter
+    {
+        using Block = std::vector<uint8_t>;
+
+        class BlockBuf : public std::streambuf {
+        public:
+            explicit BlockBuf(CompressedWriter &w) : w(w) {}
+
+            void reset(Block &block) {
+                setp(reinterpret_cast<char*>(block.data()), reinterpret_cast<char*>(block.data() + block.size()));
+            }
+
+            size_t used() const {
+                return static_cast<size_t>(pptr() - pbase());
+            }
+
+        protected:
+            int_type overflow(int_type ch) override {
+                if (!w.submit()) {
+                    return traits_type::eof();
+                }
+                if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
+                return traits_type::not_eof(ch);
+            }
+
+        private:
+            CompressedWriter &w;
+        };
+
+    public:
+        explicit CompressedWriter(std::ostream &os,
+                                  std::unique_ptr<postcompress::Codec> codec = std::make_unique<postcompress::FastLZ>(),
+                                  uint32_t blockSize = postcompress::DEFAULT_BLOCK_SIZE)
+            : target(os), codec(std::move(codec)), blockSize(std::max<uint32_t>(blockSize, 1)), 
+              full(2), empty(3), buf(*this), os(&buf) {
+            for (int i = 0; i < 3; ++i) {
+                empty.push(Block(this->blockSize));
+            }
+            empty.pop(current);
+            buf.reset(current);
+
+            std::array<uint8_t, postcompress::HEADER_SIZE> header{};
+            std::copy(postcompress::MAGIC.begin(), postcompress::MAGIC.end(), header.begin());
+            header[4] = this->codec->id();
+            boost::endian::store_big_u32(header.data() + 8, this->blockSize);
+            target.write(reinterpret_cast<const char*>(header.data()), header.size());
+            worker = std::thread([this] { compressLoop(); });
+        }
+
+        CompressedWriter(const CompressedWriter&) = delete;
+        CompressedWriter& operator=(const CompressedWriter&) = delete;
+
+        ~CompressedWriter() {
+            if (worker.joinable()) {
+                full.close();
+                worker.join();
+            }
+        }
+
+        std::ostream& stream() {
+            return os;
+        }
+
+        // Compresses what is left, writes the end marker and waits for the compression thread.
+        void finish() {
+            if (buf.used() > 0) {
+                submit();
+            }
+            full.close();
+            worker.join();
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            std::array<uint8_t, 4> end{};
+            target.write(reinterpret_cast<const char*>(end.data()), end.size());
+            target.flush();
+            if (!target) {
+                throw std::runtime_error("Could not write the compressed stream");
+            }
+        }
+
+    private:
+        bool submit() {
+            current.resize(buf.used());
+            if (!full.push(std::move(current)) || !empty.pop(current)) {
+                return false;
+            }
+            current.resize(blockSize);
+            buf.reset(current);
+            return true;
+        }
+
+        void compressLoop() {
+            Block block;
+            Block compressed(blockSize);
+            while (full.pop(block)) {
+                try {
+                    size_t size;
+                    {
+                        CVQOI_TRACE_SPAN("compressBlock");
+                        size = codec->compress(block.data(), block.size(), compressed.data(), block.size() - 1);
+                    }
+                    CVQOI_TRACE_SPAN("writeBlock");
+                    std::array<uint8_t, 8> frame;
+                    boost::endian::store_big_u32(frame.data(), static_cast<uint32_t>(block.size()));
+                    boost::endian::store_big_u32(frame.data() + 4, static_cast<uint32_t>(size ? size : block.size()));
+                    target.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+                    const auto &payload = size ? compressed : block;
+                    target.write(reinterpret_cast<const char*>(payload.data()), size ? size : block.size());
+                }
+                catch (...) {
+                    error = std::current_exception();
+                    full.close();
+                    empty.close();
+                    return;
+                }
+                empty.push(std::move(block));
+            }
+        }
+
+        std::ostream &target;
+        std::unique_ptr<postcompress::Codec> codec;
+        uint32_t blockSize;
+        BoundedQueue<Block> full;
+        BoundedQueue<Block> empty;
+        Block current;
+        BlockBuf buf;
+        std::ostream os;
+        std::thread worker;
+        std::exception_ptr error;
+    };
+
+    // Reads a stream written by CompressedWriter back into one buffer, reading the next block on a
+    // second thread while the current one is decompressed.
+    class CompressedReader
+    {
+    public:
+        static std::vector<uint8_t> read(std::istream &is) {
+            std::array<uint8_t, postcompress::HEADER_SIZE> header;
+            if (!is.read(reinterpret_cast<char*>(header.data()), header.size()) 
+                || !std::equal(postcompress::MAGIC.begin(), postcompress::MAGIC.end(), header.begin())) {
+                throw std::runtime_error("Not a compressed cvqoi stream");
+            }
+            auto codec = postcompress::codecFor(header[4]);
+            auto blockSize = boost::endian::load_big_u32(header.data() + 8);
+
+            struct Frame {
+                uint32_t rawSize;
+                std::vector<uint8_t> payload;
+            };
+            BoundedQueue<Frame> frames(2);
+            std::exception_ptr error;
+            std::thread reader([&] {
+                try {
+                    for (;;) {
+                        CVQOI_TRACE_SPAN("readBlock");
+                        std::array<uint8_t, 8> raw{};
+                        if (!is.read(reinterpret_cast<char*>(raw.data()), 4)) {
+                            throw std::runtime_error("Compressed cvqoi stream is truncated");
+                        }
+                        Frame f{boost::endian::load_big_u32(raw.data()), {}};
+                        if (f.rawSize == 0) {
+                            break;
+                        }
+                        if (!is.read(reinterpret_cast<char*>(raw.data() + 4), 4)) {
+                            throw std::runtime_error("Compressed cvqoi stream is truncated");
+                        }
+                        auto compressedSize = boost::endian::load_big_u32(raw.data() + 4);
+                        if (f.rawSize > blockSize || compressedSize > f.rawSize) {
+                            throw std::runtime_error("Corrupt compressed cvqoi block");
+                        }
+                        f.payload.resize(compressedSize);
+                        if (!is.read(reinterpret_cast<char*>(f.payload.data()), compressedSize)) {
+                            throw std::runtime_error("Compressed cvqoi stream is truncated");
+                        }
+                        if (!frames.push(std::move(f))) {
+                            break;
+                        }
+                    }
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                frames.close();
+            });
+
+            std::vector<uint8_t> out;
+            Frame f;
+            bool corrupt = false;
+            while (!corrupt && frames.pop(f)) {
+                CVQOI_TRACE_SPAN("decompressBlock");
+                auto at = out.size();
+                out.resize(at + f.rawSize);
+                if (f.rawSize == 0) {
+                    continue;
+                }
+                if (f.payload.size() == f.rawSize) {
+                    std::memcpy(out.data() + at, f.payload.data(), f.rawSize);
+                }
+                else {
+                    corrupt = !codec->decompress(f.payload.data(), f.payload.size(), out.data() + at, f.rawSize);
+                }
+            }
+            frames.close();
+            reader.join();
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            if (corrupt) {
+                throw std::runtime_error("Corrupt compressed cvqoi block");
+            }
+            return out;
+        }
+    };
+};
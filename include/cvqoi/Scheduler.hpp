@@ -0,0 +1,413 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include "cvqoi/CVQoi.hpp"
+
+// Linux only, kept out of CVQoi.hpp so the core header stays portable.
+
+namespace cvqoi
+{
+    // Fixed set of worker threads, each pinned to one CPU. CPUs are taken NUMA node by node, so
+    // a pool smaller than the machine stays on as few nodes as possible.
+    class WorkerPool
+    {
+    public:
+        explicit WorkerPool(unsigned threads = std::thread::hardware_concurrency(), bool pin = true) {
+            threads = std::max(threads, 1u);
+            auto cpus = cpuOrder();
+            // The calling thread runs tasks too.
+            for (unsigned t = 1; t < threads; ++t) {
+                workers.emplace_back([this] { work(); });
+                if (pin && !cpus.empty()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus[t % cpus.size()], &set);
+                    pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set);
+                }
+            }
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto &w : workers) {
+                w.join();
+            }
+        }
+
+        unsigned size() const {
+            return static_cast<unsigned>(workers.size() + 1);
+        }
+
+        // Same signature as cvqoi::ParallelFor. Calls from several threads run one after the other,
+        // tasks must not call it themselves. The first exception of a task is rethrown.
+        void parallelFor(size_t count, const std::function<void(size_t)> &task) {
+            if (count == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> busy(submit);
+            auto job = std::make_shared<Job>(&task, count);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = job;
+                ++generation;
+            }
+            wake.notify_all();
+            run(*job);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return job->remaining == 0; });
+                current.reset();
+            }
+            if (job->error) {
+                std::rethrow_exception(job->error);
+            }
+        }
+
+        // CPUs this process may use, grouped by NUMA node.
+        static std::vector<int> cpuOrder() {
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+                return {};
+            }
+            std::vector<int> cpus;
+            auto add = [&](int cpu) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)
+                    && std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                    cpus.push_back(cpu);
+                }
+            };
+            for (int node = 0;; ++node) {
+                std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!is) {
+                    break;
+                }
+                // Ranges like 0-3,8-11
+                std::string range;
+                while (std::getline(is, range, ',')) {
+                    int lo = 0, hi = -1;
+                    char dash = 0;
+                    std::istringstream rs(range);
+                    rs >> lo;
+                    hi = (rs >> dash >> hi && dash == '-') ? hi : lo;
+                    for (int cpu = lo; cpu <= hi; ++cpu) {
+                        add(cpu);
+                    }
+                }
+            }
+            // No NUMA information, or CPUs missing from it.
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                add(cpu);
+            }
+            return cpus;
+        }
+
+    private:
+        struct Job {
+            Job(const std::function<void(size_t)> *task, size_t count) : task(task), count(count), remaining(count) {}
+
+            const std::function<void(size_t)> *task;
+            size_t count;
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> remaining;
+            std::mutex errorMutex;
+            std::exception_ptr error;
+        };
+
+        // Workers that wake up late only find indices past the end of their job.
+        void run(Job &job) {
+            for (;;) {
+                auto i = job.next++;
+                if (i >= job.count) {
+                    return;
+                }
+                try {
+                    (*job.task)(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(job.errorMutex);
+                    if (!job.error) {
+                        job.error = std::current_exception();
+                    }
+                }
+                if (--job.remaining == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+
+        void work() {
+            uint64_t seen = 0;
+            for (;;) {
+                std::shared_ptr<Job> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return stop || generation != seen; });
+                    if (stop) {
+                        return;
+                    }
+                    seen = generation;
+                    job = current;
+                }
+                if (job) {
+                    run(*job);
+                }
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::mutex submit;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        std::shared_ptr<Job> current;
+        uint64_t generation{0};
+        bool stop{false};
+    };
+
+    // Chooses how to spread encoding over a WorkerPool: serial, stripes of one image in parallel
+    // (see Encoder::stripes) or whole images of a batch in parallel. Where stripes start to pay off
+    // depends on the machine, as does the image size from which a batch is worth spreading over
+    // the pool. Both are measured with a short benchmark on first use and cached.
+    //
+    //     cvqoi::Scheduler scheduler;
+    //     std::vector<std::vector<char>> encoded;
+    //     scheduler.encode(frames, encoded);
+    class Scheduler
+    {
+    public:
+        enum class Mode {
+            Serial,
+            Stripes,
+            Batch
+        };
+
+        struct Thresholds {
+            unsigned threads;
+            uint64_t stripeBytes;  // Smallest stripe worth a task of its own, in bytes of pixels.
+            uint64_t batchBytes;   // Smallest image worth a task of its own in a batch, in bytes of pixels.
+        };
+
+        // An empty cachePath calibrates every time.
+        explicit Scheduler(unsigned threads = std::thread::hardware_concurrency(),
+                           const std::string &cachePath = defaultCachePath())
+            : pool(threads) {
+            if (!load(cachePath)) {
+                limits = calibrate(pool);
+                save(cachePath);
+            }
+        }
+
+        const Thresholds& thresholds() const {
+            return limits;
+        }
+
+        // Stripes one image of that many bytes is worth splitting into.
+        uint32_t stripesFor(uint64_t bytes) const {
+            return static_cast<uint32_t>(std::clamp<uint64_t>(bytes / limits.stripeBytes, 1, pool.size()));
+        }
+
+        // batch images of about bytes each.
+        Mode choose(uint64_t bytes, size_t batch) const {
+            auto stripes = stripesFor(bytes);
+            // Below batchBytes handing out the images costs more than encoding them.
+            auto parallelBatch = batch > 1 && bytes >= limits.batchBytes;
+            if (parallelBatch && batch >= stripes) {
+                // As many tasks as stripes would give, without the extra scan.
+                return Mode::Batch;
+            }
+            return stripes > 1 ? Mode::Stripes : (parallelBatch ? Mode::Batch : Mode::Serial);
+        }
+
+        void encode(const cv::Mat &mat, std::vector<char> &out) {
+            auto bytes = mat.total() * mat.elemSize();
+            encodeImage(mat, out, choose(bytes, 1) == Mode::Stripes ? stripesFor(bytes) : 1, runner());
+        }
+
+        // Images may differ in size and channel count, the mode is chosen for their average size.
+        void encode(const std::vector<cv::Mat> &mats, std::vector<std::vector<char>> &out) {
+            out.resize(mats.size());
+            if (mats.empty()) {
+                return;
+            }
+            uint64_t bytes = 0;
+            for (auto &m : mats) {
+                bytes += m.total() * m.elemSize();
+            }
+            auto mode = choose(bytes / mats.size(), mats.size());
+            if (mode == Mode::Batch) {
+                pool.parallelFor(mats.size(), [&](size_t i) { encodeImage(mats[i], out[i], 1); });
+                return;
+            }
+            for (size_t i = 0; i < mats.size(); ++i) {
+                auto b = mats[i].total() * mats[i].elemSize();
+                encodeImage(mats[i], out[i], mode == Mode::Stripes ? stripesFor(b) : 1, runner());
+            }
+        }
+
+        // Encodes a synthetic frame at growing sizes, serial and in two stripes, and takes the
+        // smallest size where the stripes are clearly faster. The same for a batch of small frames,
+        // one after the other and spread over the pool.
+        static Thresholds calibrate(WorkerPool &pool) {
+            Thresholds t{pool.size(), UINT64_MAX, UINT64_MAX};
+            if (pool.size() < 2) {
+                return t;
+            }
+            auto best = [](const std::function<void()> &encode) {
+                auto fastest = std::chrono::steady_clock::duration::max();
+                for (int run = 0; run < 3; ++run) {
+                    auto start = std::chrono::steady_clock::now();
+                    encode();
+                    fastest = std::min(fastest, std::chrono::steady_clock::now() - start);
+                }
+                return fastest;
+            };
+            std::vector<char> out;
+            for (int side = 64; side <= 2048; side *= 2) {
+                auto m = syntheticFrame(side);
+                auto striped = best([&] { encodeImage(m, out, 2, runner(pool)); });
+                if (striped * 10 < best([&] { encodeImage(m, out, 1); }) * 9) {
+                    t.stripeBytes = m.total() * m.elemSize() / 2;
+                    break;
+                }
+            }
+            std::vector<std::vector<char>> outs(pool.size() * 4);
+            for (int side = 4; side <= 256; side *= 2) {
+                auto m = syntheticFrame(side);
+                auto batched = best([&] {
+                    pool.parallelFor(outs.size(), [&](size_t i) { encodeImage(m, outs[i], 1); });
+                });
+                auto serial = best([&] {
+                    for (auto &o : outs) {
+                        encodeImage(m, o, 1);
+                    }
+                });
+                if (batched * 10 < serial * 9) {
+                    t.batchBytes = m.total() * m.elemSize();
+                    break;
+                }
+            }
+            return t;
+        }
+
+        // $XDG_CACHE_HOME/cvqoi/scheduler or ~/.cache/cvqoi/scheduler
+        static std::string defaultCachePath() {
+            std::string dir;
+            if (auto *xdg = std::getenv("XDG_CACHE_HOME")) {
+                dir = xdg;
+            }
+            else if (auto *home = std::getenv("HOME")) {
+                dir = std::string(home) + "/.cache";
+            }
+            else {
+                return {};
+            }
+            return dir + "/cvqoi/scheduler";
+        }
+
+    private:
+        static ParallelFor runner(WorkerPool &pool) {
+            return [&pool](size_t n, const std::function<void(size_t)> &task) { pool.parallelFor(n, task); };
+        }
+
+        ParallelFor runner() {
+            return runner(pool);
+        }
+
+        static void encodeImage(const cv::Mat &mat, std::vector<char> &out, uint32_t stripes, ParallelFor run = {}) {
+            if (mat.channels() == 4) {
+                write(Encoder<true>(mat).stripes(stripes, std::move(run)), out);
+            }
+            else {
+                write(Encoder<>(mat).stripes(stripes, std::move(run)), out);
+            }
+        }
+
+        // One allocation, the output is written straight into out.
+        template<typename E>
+        static void write(const E &e, std::vector<char> &out) {
+            out.resize(static_cast<size_t>(e.maxSize()));
+            FixedBuf buf(out.data(), out.size());
+            std::ostream os(&buf);
+            os << e;
+            out.resize(buf.size());
+        }
+
+        // Gradients with flat areas and a little noise, roughly what a camera frame encodes like.
+        static cv::Mat syntheticFrame(int side) {
+            cv::Mat m(side, side, CV_8UC3);
+            uint32_t noise = 12345;
+            for (int r = 0; r < side; ++r) {
+                auto *row = m.ptr<uint8_t>(r);
+                for (int c = 0; c < side * 3; ++c) {
+                    noise = noise * 1103515245 + 12345;
+                    auto flat = (r / 16 + c / 48) % 3 == 0;
+                    row[c] = static_cast<uint8_t>(flat ? 128 : (r + c / 3) / 2 + ((noise >> 16) & 3));
+                }
+            }
+            return m;
+        }
+
+        // Cache format: "cvqoi-scheduler 2 <threads> <stripeBytes> <batchBytes>", only valid for the same
+        // thread count.
+        bool load(const std::string &path) {
+            if (path.empty()) {
+                return false;
+            }
+            std::ifstream is(path);
+            std::string magic;
+            int version = 0;
+            Thresholds t{};
+            if (!(is >> magic >> version >> t.threads >> t.stripeBytes >> t.batchBytes) || magic != "cvqoi-scheduler"
+                || version != 2 || t.threads != pool.size() || t.stripeBytes == 0 || t.batchBytes == 0) {
+                return false;
+            }
+            limits = t;
+            return true;
+        }
+
+        // A cache that can not be written only means calibrating again next time.
+        void save(const std::string &path) const {
+            if (path.empty()) {
+                return;
+            }
+            for (auto slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+                ::mkdir(path.substr(0, slash).c_str(), 0755);
+            }
+            std::ofstream os(path);
+            os << "cvqoi-scheduler 2 " << limits.threads << " " << limits.stripeBytes << " " << limits.batchBytes
+               << "\n";
+        }
+
+        WorkerPool pool;
+        Thresholds limits{};
+    };
+};
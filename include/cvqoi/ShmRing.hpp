@@ -0,0 +1,238 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cvqoi/CVQoi.hpp"
+
+// POSIX only, kept out of CVQoi.hpp so the core header stays portable.
+
+namespace cvqoi
+{
+    // Single producer, single consumer ring of fixed size slots in POSIX shared memory. The producer
+    // encodes straight into a slot and publishes it by bumping the slot's sequence number, the
+    // consumer process reads the bytes in place and hands the slot back. No locks and no copies.
+    //
+    //     auto ring = cvqoi::ShmRing::create("/frames", 8, cvqoi::Encoder<>(mat).maxSize());
+    //     ring.publish(cvqoi::Encoder<>(mat));
+    //
+    //     auto ring = cvqoi::ShmRing::open("/frames");    //In the consumer process
+    //     auto frame = ring.acquire();
+    //     cvqoi::Decoder::decode(frame.data, frame.size, mat);
+    //     ring.release(frame);
+    class ShmRing
+    {
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs address free atomics.");
+        static constexpr uint64_t MAGIC = 0x63767130'72696e67; // "cvq0ring"
+        static constexpr size_t ALIGN = 64;
+
+        struct Control {
+            uint64_t magic;
+            uint64_t slotCount;
+            uint64_t slotSize;
+            alignas(ALIGN) std::atomic<uint64_t> head;  // Next sequence the producer writes.
+            alignas(ALIGN) std::atomic<uint64_t> tail;  // Next sequence the consumer releases.
+        };
+
+        // A slot holding sequence n is published when its sequence is n + 1.
+        struct alignas(ALIGN) Slot {
+            std::atomic<uint64_t> sequence;
+            uint64_t size;
+            uint64_t publishNs;
+        };
+
+    public:
+        struct Frame {
+            const uint8_t *data;
+            size_t size;
+            uint64_t sequence;
+            std::chrono::steady_clock::time_point published;
+        };
+
+        // Creates the ring, slotSize should come from Encoder::maxSize(). The creator unlinks it on destruction.
+        static ShmRing create(const std::string &name, uint32_t slotCount, size_t slotSize) {
+            if (slotCount == 0 || slotSize == 0) {
+                throw std::invalid_argument("Ring must have at least one non empty slot");
+            }
+            int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "Could not create " + name);
+            }
+            auto length = mappedSize(slotCount, slotSize);
+            if (::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+                auto err = errno;
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                throw std::system_error(err, std::generic_category(), "Could not size " + name);
+            }
+            ShmRing ring(name, fd, length, true);
+            auto *control = new (ring.base) Control;
+            control->slotCount = slotCount;
+            control->slotSize = slotSize;
+            control->head.store(0, std::memory_order_relaxed);
+            control->tail.store(0, std::memory_order_relaxed);
+            for (uint64_t i = 0; i < slotCount; ++i) {
+                new (&ring.slot(i)) Slot{{0}, 0, 0};
+            }
+            // The consumer checks the magic last, so everything above is visible once it matches.
+            std::atomic_thread_fence(std::memory_order_release);
+            control->magic = MAGIC;
+            return ring;
+        }
+
+        static ShmRing open(const std::string &name) {
+            int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "Could not open " + name);
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Control)) {
+                ::close(fd);
+                throw std::runtime_error(name + " is not a cvqoi ring");
+            }
+            ShmRing ring(name, fd, static_cast<size_t>(st.st_size), false);
+            auto *control = ring.control();
+            if (control->magic != MAGIC 
+                || mappedSize(control->slotCount, control->slotSize) > static_cast<size_t>(st.st_size)) {
+                throw std::runtime_error(name + " is not a cvqoi ring");
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return ring;
+        }
+
+        ShmRing(ShmRing &&other) noexcept 
+            : name(std::move(other.name)), fd(std::exchange(other.fd, -1)), base(std::exchange(other.base, nullptr)),
+              length(other.length), owner(other.owner) {}
+
+        ShmRing(const ShmRing&) = delete;
+        ShmRing& operator=(const ShmRing&) = delete;
+        ShmRing& operator=(ShmRing&&) = delete;
+
+        ~ShmRing() {
+            if (base) {
+                ::munmap(base, length);
+            }
+            if (fd >= 0) {
+                ::close(fd);
+                if (owner) {
+                    ::shm_unlink(name.c_str());
+                }
+            }
+        }
+
+        size_t slotSize() const {
+            return control()->slotSize;
+        }
+
+        // Producer side. Encodes into the next slot and publishes it, returns false without
+        // encoding when the consumer has not released any slot yet.
+        template<bool hasAlpha>
+        bool tryPublish(const Encoder<hasAlpha> &e) {
+            auto *c = control();
+            auto seq = c->head.load(std::memory_order_relaxed);
+            if (seq - c->tail.load(std::memory_order_acquire) >= c->slotCount) {
+                return false;
+            }
+            if (e.maxSize() > c->slotSize) {
+                throw std::length_error("Encoded image may not fit in a ring slot");
+            }
+            auto &s = slot(seq % c->slotCount);
+            FixedBuf buf(reinterpret_cast<char*>(payload(s)), c->slotSize);
+            std::ostream os(&buf);
+            os << e;
+            s.size = buf.size();
+            s.publishNs = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+            s.sequence.store(seq + 1, std::memory_order_release);
+            c->head.store(seq + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Spins, yielding, until a slot is free.
+        template<bool hasAlpha>
+        void publish(const Encoder<hasAlpha> &e) {
+            while (!tryPublish(e)) {
+                std::this_thread::yield();
+            }
+        }
+
+        // Consumer side. The frame points into shared memory and stays valid until release().
+        bool tryAcquire(Frame &frame) {
+            auto *c = control();
+            auto seq = c->tail.load(std::memory_order_relaxed);
+            auto &s = slot(seq % c->slotCount);
+            if (s.sequence.load(std::memory_order_acquire) != seq + 1) {
+                return false;
+            }
+            frame.data = payload(s);
+            frame.size = s.size;
+            frame.sequence = seq;
+            frame.published = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(s.publishNs));
+            return true;
+        }
+
+        Frame acquire() {
+            Frame frame;
+            while (!tryAcquire(frame)) {
+                std::this_thread::yield();
+            }
+            return frame;
+        }
+
+        // Frames must be released in the order they were acquired.
+        void release(const Frame &frame) {
+            control()->tail.store(frame.sequence + 1, std::memory_order_release);
+        }
+
+    private:
+        ShmRing(std::string name, int fd, size_t length, bool owner) 
+            : name(std::move(name)), fd(fd), length(length), owner(owner) {
+            void *p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                auto err = errno;
+                ::close(fd);
+                if (owner) {
+                    ::shm_unlink(this->name.c_str());
+                }
+                this->fd = -1;
+                throw std::system_error(err, std::generic_category(), "Could not map " + this->name);
+            }
+            base = static_cast<uint8_t*>(p);
+        }
+
+        static size_t slotStride(size_t slotSize) {
+            return (sizeof(Slot) + slotSize + ALIGN - 1) / ALIGN * ALIGN;
+        }
+
+        static size_t mappedSize(uint64_t slotCount, uint64_t slotSize) {
+            return sizeof(Control) + slotCount * slotStride(slotSize);
+        }
+
+        Control* control() const {
+            return reinterpret_cast<Control*>(base);
+        }
+
+        Slot& slot(uint64_t i) const {
+            return *reinterpret_cast<Slot*>(base + sizeof(Control) + i * slotStride(control()->slotSize));
+        }
+
+        static uint8_t* payload(Slot &s) {
+            return reinterpret_cast<uint8_t*>(&s) + sizeof(Slot);
+        }
+
+        std::string name;
+        int fd{-1};
+        uint8_t *base{nullptr};
+        size_t length{0};
+        bool owner{false};
+    };
+};
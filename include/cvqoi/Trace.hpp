@@ -0,0 +1,162 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// Opt-in timing spans, dumped as Chrome trace-event JSON (chrome://tracing or ui.perfetto.dev).
+// Define CVQOI_TRACE before including any cvqoi header to record them. Without it every
+// CVQOI_TRACE_SPAN compiles to nothing and dump does nothing.
+//
+//     CVQOI_TRACE_SPAN("upload");     //Times the rest of the enclosing scope
+//     ...
+//     cvqoi::trace::dump("trace.json");
+
+//#define CVQOI_TRACE
+
+namespace cvqoi
+{
+    namespace trace {
+        // Rows the Encoder puts in one encodeImage span.
+        constexpr uint32_t BAND_ROWS = 64;
+    }
+}
+
+#ifdef CVQOI_TRACE
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace cvqoi
+{
+    namespace trace {
+        // Spans kept per thread, later ones are counted as dropped.
+        constexpr size_t BUFFER_EVENTS = 1 << 16;
+
+        struct Event {
+            const char *name;  // Must be a string literal.
+            uint64_t begin;    // Nanoseconds since the first span of the process.
+            uint64_t end;
+        };
+
+        // Only its own thread writes. count is published with release, so dump can read the
+        // events below it from another thread without a lock.
+        struct Buffer {
+            uint32_t tid{0};
+            std::atomic<size_t> count{0};
+            std::atomic<size_t> dropped{0};
+            std::array<Event, BUFFER_EVENTS> events;
+
+            void push(const Event &e) {
+                auto n = count.load(std::memory_order_relaxed);
+                if (n == events.size()) {
+                    dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return;
+                }
+                events[n] = e;
+                count.store(n + 1, std::memory_order_release);
+            }
+        };
+
+        // The mutex is only taken when a thread records its first span and by dump. Buffers are
+        // shared so they outlive their threads.
+        struct Registry {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<Buffer>> buffers;
+            std::chrono::steady_clock::time_point origin{std::chrono::steady_clock::now()};
+        };
+
+        inline Registry& registry() {
+            static Registry r;
+            return r;
+        }
+
+        inline uint64_t now() {
+            auto elapsed = std::chrono::steady_clock::now() - registry().origin;
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+
+        inline Buffer& local() {
+            thread_local std::shared_ptr<Buffer> buffer = [] {
+                auto b = std::make_shared<Buffer>();
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                b->tid = static_cast<uint32_t>(r.buffers.size() + 1);
+                r.buffers.push_back(b);
+                return b;
+            }();
+            return *buffer;
+        }
+
+        class Span
+        {
+        public:
+            explicit Span(const char *name) : name(name), begin(now()) {}
+
+            Span(const Span&) = delete;
+            Span& operator=(const Span&) = delete;
+
+            ~Span() {
+                local().push({name, begin, now()});
+            }
+
+        private:
+            const char *name;
+            uint64_t begin;
+        };
+
+        // Writes every span recorded so far. Threads may keep recording meanwhile, what they add
+        // after their buffer was read is left out.
+        inline void dump(const std::string &path) {
+            std::vector<std::shared_ptr<Buffer>> buffers;
+            {
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                buffers = r.buffers;
+            }
+            std::ofstream os(path);
+            if (!os) {
+                throw std::runtime_error("Could not open " + path);
+            }
+            os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+            size_t dropped = 0;
+            const char *separator = "\n";
+            for (auto &b : buffers) {
+                auto n = b->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < n; ++i) {
+                    auto &e = b->events[i];
+                    // Chrome wants microseconds.
+                    os << separator << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+                       << ",\"ts\":" << e.begin / 1e3 << ",\"dur\":" << (e.end - e.begin) / 1e3 << "}";
+                    separator = ",\n";
+                }
+                dropped += b->dropped.load(std::memory_order_relaxed);
+            }
+            os << "\n],\"otherData\":{\"droppedSpans\":" << dropped << "}}\n";
+            if (!os) {
+                throw std::runtime_error("Could not write " + path);
+            }
+        }
+    }
+}
+
+#define CVQOI_TRACE_CONCAT_(a, b) a##b
+#define CVQOI_TRACE_CONCAT(a, b) CVQOI_TRACE_CONCAT_(a, b)
+#define CVQOI_TRACE_SPAN(name) ::cvqoi::trace::Span CVQOI_TRACE_CONCAT(cvqoiTraceSpan, __LINE__){name}
+
+#else
+
+namespace cvqoi
+{
+    namespace trace {
+        inline void dump(const std::string&) {}
+    }
+}
+
+#define CVQOI_TRACE_SPAN(name) do {} while (0)
+
+#endif
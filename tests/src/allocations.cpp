@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+
+namespace bfs = boost::filesystem;
+namespace bstrs = boost::iostreams;
+
+// Heap allocations per encoded and decoded image of the corpus. Global operator new is replaced
+// everywhere, malloc too with glibc, which also catches cv::fastMalloc. Fails when the paths
+// that should not allocate per image go over their budget:
+//
+//     cvqoiallocations <qoi_test_images> [encode budget] [decode budget]
+//
+// The encode budget is for an Encoder writing into a FixedBuf sized with maxSize(), the decode
+// budget for Decoder::decode into a cv::Mat that already has the right size.
+
+namespace counter {
+    std::atomic<bool> enabled{false};
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> bytes{0};
+
+    void count(std::size_t size) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    struct Result {
+        std::size_t allocations;
+        std::size_t bytes;
+    };
+
+    template<typename F>
+    Result measure(F &&f) {
+        allocations = 0;
+        bytes = 0;
+        enabled = true;
+        f();
+        enabled = false;
+        return {allocations, bytes};
+    }
+}
+
+#ifdef __GLIBC__
+extern "C" {
+    void* __libc_malloc(std::size_t);
+    void* __libc_calloc(std::size_t, std::size_t);
+    void* __libc_realloc(void*, std::size_t);
+
+    void* malloc(std::size_t size) {
+        counter::count(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(std::size_t n, std::size_t size) {
+        counter::count(n * size);
+        return __libc_calloc(n, size);
+    }
+
+    void* realloc(void *p, std::size_t size) {
+        counter::count(size);
+        return __libc_realloc(p, size);
+    }
+}
+
+// operator new goes through malloc, counted there.
+#else
+void* operator new(std::size_t size) {
+    counter::count(size);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+struct Totals {
+    const char *name;
+    std::size_t allocations{0};
+    std::size_t bytes{0};
+    std::size_t maxAllocations{0};
+
+    void add(const counter::Result &r) {
+        allocations += r.allocations;
+        bytes += r.bytes;
+        maxAllocations = std::max(maxAllocations, r.allocations);
+    }
+
+    void print(std::size_t images, std::size_t encodedSize) const {
+        std::cout << name << ": " << static_cast<double>(allocations) / images << " allocations, ";
+        std::cout << static_cast<double>(bytes) / images << " bytes per image (";
+        std::cout << static_cast<double>(bytes) / encodedSize << "x the encoded size), ";
+        std::cout << "at most " << maxAllocations << " for one image" << std::endl;
+    }
+};
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Please give path to the qoi_test_images as an argument to the program!" << std::endl;
+        return 1;
+    }
+    std::size_t encodeBudget = argc > 2 ? std::stoul(argv[2]) : 0;
+    std::size_t decodeBudget = argc > 3 ? std::stoul(argv[3]) : 0;
+
+    std::vector<cv::Mat> images;
+    for (auto &x : bfs::directory_iterator(argv[1])) {
+        if (x.path().extension() == ".png") {
+            images.push_back(cv::imread(x.path().string(), cv::IMREAD_UNCHANGED));
+        }
+    }
+    if (images.empty()) {
+        std::cout << "There are no png files inside " << argv[1] << "!" << std::endl;
+        return 1;
+    }
+
+    Totals fixed{"Encoder into a FixedBuf"}, vector{"Encoder into a back_insert_device"};
+    Totals string{"Encoder into a std::ostringstream"}, options{"Encoder with row index and checksum"};
+    Totals decode{"Decoder::decode into a sized cv::Mat"};
+    std::size_t encodedSize = 0;
+    std::vector<char> out;
+    cv::Mat decoded;
+    for (auto &img : images) {
+        bool alpha = img.channels() == 4;
+        auto maxSize = alpha ? cvqoi::Encoder<true>(img).maxSize() : cvqoi::Encoder<>(img).maxSize();
+        out.resize(static_cast<std::size_t>(maxSize));
+
+        std::size_t size = 0;
+        fixed.add(counter::measure([&] {
+            cvqoi::FixedBuf buf(out.data(), out.size());
+            std::ostream os(&buf);
+            if (alpha) {
+                os << cvqoi::Encoder<true>(img);
+            }
+            else {
+                os << cvqoi::Encoder<>(img);
+            }
+            size = buf.size();
+        }));
+        encodedSize += size;
+
+        vector.add(counter::measure([&] {
+            std::vector<char> encoded;
+            bstrs::back_insert_device<std::vector<char>> sink{encoded};
+            bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+            if (alpha) {
+                os << cvqoi::Encoder<true>(img);
+            }
+            else {
+                os << cvqoi::Encoder<>(img);
+            }
+            os.flush();
+        }));
+
+        string.add(counter::measure([&] {
+            std::ostringstream os;
+            if (alpha) {
+                os << cvqoi::Encoder<true>(img);
+            }
+            else {
+                os << cvqoi::Encoder<>(img);
+            }
+        }));
+
+        options.add(counter::measure([&] {
+            std::ostringstream os;
+            if (alpha) {
+                os << cvqoi::Encoder<true>(img).rowIndex(16).checksum();
+            }
+            else {
+                os << cvqoi::Encoder<>(img).rowIndex(16).checksum();
+            }
+        }));
+
+        decoded.create(img.rows, img.cols, img.type());
+        auto *data = reinterpret_cast<const uint8_t*>(out.data());
+        decode.add(counter::measure([&] {
+            cvqoi::Decoder::decode(data, size, decoded);
+        }));
+    }
+
+    std::cout << images.size() << " images, " << encodedSize << " bytes encoded" << std::endl;
+    for (auto *t : {&fixed, &vector, &string, &options, &decode}) {
+        t->print(images.size(), encodedSize);
+    }
+
+    bool ok = true;
+    if (fixed.maxAllocations > encodeBudget) {
+        std::cout << "Encoding into a preallocated buffer allocates " << fixed.maxAllocations
+                  << " times, the budget is " << encodeBudget << std::endl;
+        ok = false;
+    }
+    if (decode.maxAllocations > decodeBudget) {
+        std::cout << "Decoding into a sized cv::Mat allocates " << decode.maxAllocations
+                  << " times, the budget is " << decodeBudget << std::endl;
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
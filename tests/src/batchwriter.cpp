@@ -0,0 +1,88 @@
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/BatchWriter.hpp"
+
+namespace bfs = boost::filesystem;
+namespace bstrs = boost::iostreams;
+
+// Files per second of cvqoi::BatchWriter against encoding straight into a std::ofstream per file,
+// for many small images. Every written file is read back and checked.
+
+cv::Mat makeTile(int size, int n) {
+    cv::Mat mat(size, size, CV_8UC4);
+    for (int r = 0; r < size; ++r) {
+        auto *row = mat.ptr<uint8_t>(r);
+        for (int c = 0; c < size * 4; ++c) {
+            row[c] = static_cast<uint8_t>((r * 3 + c / 4 + n) % 7 * 30);
+        }
+    }
+    return mat;
+}
+
+bool verify(const bfs::path &dir, const std::vector<std::vector<char>> &encoded) {
+    for (std::size_t i = 0; i < encoded.size(); ++i) {
+        std::ifstream is((dir / (std::to_string(i) + ".qoi")).string(), std::ios::binary);
+        std::vector<char> bytes{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+        if (bytes != encoded[i]) {
+            std::cout << "File " << i << " in " << dir << " does not match!" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char **argv) {
+    bfs::path dir = argc > 1 ? bfs::path(argv[1]) : bfs::temp_directory_path() / "cvqoi_batchwriter";
+    int files = argc > 2 ? std::stoi(argv[2]) : 5000;
+    int tileSize = argc > 3 ? std::stoi(argv[3]) : 32;
+    bfs::create_directories(dir / "ofstream");
+    bfs::create_directories(dir / "batch");
+
+    std::vector<cv::Mat> tiles;
+    for (int i = 0; i < files; ++i) {
+        tiles.push_back(makeTile(tileSize, i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < files; ++i) {
+        std::ofstream os((dir / "ofstream" / (std::to_string(i) + ".qoi")).string(), std::ios::binary);
+        os << cvqoi::Encoder<true>(tiles[i]);
+    }
+    std::chrono::duration<double> streamTime = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::vector<char>> encoded(files);
+    start = std::chrono::steady_clock::now();
+    cvqoi::BatchWriter writer;
+    for (int i = 0; i < files; ++i) {
+        {
+            bstrs::back_insert_device<std::vector<char>> sink{encoded[i]};
+            bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+            os << cvqoi::Encoder<true>(tiles[i]);
+        }
+        writer.write((dir / "batch" / (std::to_string(i) + ".qoi")).string(), encoded[i]);
+    }
+    writer.flush();
+    std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - start;
+
+    auto backend = writer.backend() == cvqoi::BatchWriter::Backend::IoUring ? "io_uring" : "pwritev";
+    std::cout << files << " files of " << tileSize << "x" << tileSize << std::endl;
+    std::cout << "std::ofstream: " << files / streamTime.count() << " files/s" << std::endl;
+    std::cout << "BatchWriter (" << backend << "): " << files / batchTime.count() << " files/s" << std::endl;
+    if (!verify(dir / "ofstream", encoded) || !verify(dir / "batch", encoded)) {
+        return 1;
+    }
+    bfs::remove_all(dir);
+#ifdef CVQOI_TRACE
+    cvqoi::trace::dump("cvqoi_trace.json");
+#endif
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <string>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/ImgCodecs.hpp"
+
+namespace bfs = boost::filesystem;
+
+// cvqoi::imwrite / cvqoi::imread against cv::imwrite / cv::imread with PNG, on every corpus image.
+// Every image read back is checked against the original, also through cvqoi::imencode / imdecode
+// and with the IMREAD_REDUCED_* flags.
+//
+//     cvqoiimgcodecs <qoi_test_images> [output directory]
+
+bool same(const cv::Mat &a, const cv::Mat &b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) {
+        return false;
+    }
+    for (int r = 0; r < a.rows; ++r) {
+        if (std::memcmp(a.ptr(r), b.ptr(r), a.cols * a.elemSize()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Please give path to the qoi_test_images as an argument to the program!" << std::endl;
+        return 1;
+    }
+    bfs::path out = argc > 2 ? bfs::path(argv[2]) : bfs::temp_directory_path();
+
+    std::vector<cv::Mat> images;
+    for (auto &x : bfs::directory_iterator(argv[1])) {
+        if (x.path().extension() == ".png") {
+            images.push_back(cv::imread(x.path().string(), cv::IMREAD_UNCHANGED));
+        }
+    }
+    if (images.empty()) {
+        std::cout << "There are no png files inside " << argv[1] << "!" << std::endl;
+        return 1;
+    }
+    std::size_t rawSize = 0;
+    for (auto &img : images) {
+        rawSize += img.total() * img.elemSize();
+    }
+
+    auto png = (out / "cvqoiimgcodecs.png").string();
+    auto qoi = (out / "cvqoiimgcodecs.qoi").string();
+    std::chrono::duration<double> pngWrite{0}, pngRead{0}, qoiWrite{0}, qoiRead{0};
+    std::vector<uint8_t> buf;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        auto start = std::chrono::steady_clock::now();
+        cv::imwrite(png, images[i]);
+        pngWrite += std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        cv::imread(png, cv::IMREAD_UNCHANGED);
+        pngRead += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        if (!cvqoi::imwrite(qoi, images[i])) {
+            std::cout << "Could not write " << qoi << std::endl;
+            return 1;
+        }
+        qoiWrite += std::chrono::steady_clock::now() - start;
+        // 8-bit gray is stored as BGR and read back with IMREAD_GRAYSCALE, gray with alpha comes back as BGRA.
+        cv::Mat expected = images[i];
+        int flags = cv::IMREAD_UNCHANGED;
+        if (images[i].depth() == CV_8U && images[i].channels() == 1) {
+            flags = cv::IMREAD_GRAYSCALE;
+        }
+        else if (images[i].depth() == CV_8U && images[i].channels() == 2) {
+            expected = cvqoi::imgcodecs::toChannels<uint8_t>(images[i], 4);
+        }
+        start = std::chrono::steady_clock::now();
+        cv::Mat fromQoi = cvqoi::imread(qoi, flags);
+        qoiRead += std::chrono::steady_clock::now() - start;
+        if (!same(fromQoi, expected)) {
+            std::cout << "cvqoi::imread differs from the original for image " << i << std::endl;
+            return 1;
+        }
+
+        cvqoi::imencode(images[i], buf);
+        if (!same(cvqoi::imdecode(buf, flags), expected)) {
+            std::cout << "cvqoi::imdecode differs from the original for image " << i << std::endl;
+            return 1;
+        }
+        if (!cvqoi::imdecode(buf.data(), buf.size() / 2, flags).empty()) {
+            std::cout << "cvqoi::imdecode did not reject a truncated image " << i << std::endl;
+            return 1;
+        }
+        // Reduced reads average each block, then convert like the full size ones.
+        for (int reduced : {cv::IMREAD_REDUCED_COLOR_2, cv::IMREAD_REDUCED_GRAYSCALE_4, cv::IMREAD_REDUCED_COLOR_8}) {
+            int scale = cvqoi::imgcodecs::reduction(reduced);
+            cv::Mat small = cvqoi::imdecode(buf, reduced);
+            cv::Mat smallExpected = expected.depth() == CV_16U
+                                    ? cvqoi::imgcodecs::reduce<uint16_t>(expected, scale)
+                                    : cvqoi::imgcodecs::reduce<uint8_t>(expected, scale);
+            cvqoi::imgcodecs::convert(smallExpected, reduced);
+            if (small.rows != (images[i].rows + scale - 1) / scale
+                || small.cols != (images[i].cols + scale - 1) / scale || !same(small, smallExpected)) {
+                std::cout << "cvqoi::imdecode with reduced flag " << reduced << " is wrong for image " << i << std::endl;
+                return 1;
+            }
+        }
+    }
+    bfs::remove(png);
+    bfs::remove(qoi);
+
+    std::cout << "cv::imwrite png: " << rawSize / 1e6 / pngWrite.count() << " MB/s, cv::imread png: ";
+    std::cout << rawSize / 1e6 / pngRead.count() << " MB/s" << std::endl;
+    std::cout << "cvqoi::imwrite: " << rawSize / 1e6 / qoiWrite.count() << " MB/s, cvqoi::imread: ";
+    std::cout << rawSize / 1e6 / qoiRead.count() << " MB/s" << std::endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <boost/filesystem/path.hpp>
+#include <chrono>
 #include <cstddef>
 #include <fstream>
 #include <iostream>
@@ -8,12 +9,15 @@
 #include <opencv2/imgproc.hpp>
 #include <boost/filesystem.hpp>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/stream.hpp>
 #include "cvqoi/CVQoi.hpp"
+#include "cvqoi/Fixed.hpp"
+#include "cvqoi/PostCompress.hpp"
 
 #define QOI_IMPLEMENTATION
 #include "qoi.h"
@@ -135,10 +139,579 @@ int main(int argc, const char **argv) {
 
     std::cout << "Successfully encoded all PNG Images using CVQoi" << std::endl;
 
+    for (std::size_t i = 0; i < pngImages.size(); ++i) {
+        std::vector<char> indexed;
+        bstrs::back_insert_device<std::vector<char>> sink{indexed};
+        bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+        if (pngImages[i].channels() == 4) {
+            os << cvqoi::Encoder<true>(pngImages[i]).rowIndex(16);
+        }
+        else {
+            os << cvqoi::Encoder<>(pngImages[i]).rowIndex(16);
+        }
+        os.flush();
+
+        cv::Mat decoded, band;
+        auto *data = reinterpret_cast<const uint8_t*>(indexed.data());
+        cvqoi::Decoder::decode(data, indexed.size(), decoded);
+        auto first = pngImages[i].rows / 2, last = std::min(first + 20, pngImages[i].rows);
+        cvqoi::Decoder::decodeRows(data, indexed.size(), first, last, band);
+        if (cv::norm(decoded, pngImages[i], cv::NORM_INF) != 0 
+            || cv::norm(band, pngImages[i].rowRange(first, last), cv::NORM_INF) != 0) {
+            std::cout << "CVQoi round trip failed for " << pngFiles[i].filename() << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Successfully decoded all CVQoi images, including row bands" << std::endl;
+
+    //Scaled decoding against a reference over the full image, and against full decode + cv::resize.
+    //The extra image has a size that no scale above 1 divides, so edge blocks are partial.
+    {
+        auto reference = [](const cv::Mat &img, int scale, bool box) {
+            cv::Mat out((img.rows + scale - 1) / scale, (img.cols + scale - 1) / scale, img.type());
+            int channels = img.channels();
+            for (int r = 0; r < out.rows; ++r) {
+                for (int c = 0; c < out.cols; ++c) {
+                    int rows = std::min(scale, img.rows - r * scale), cols = std::min(scale, img.cols - c * scale);
+                    for (int k = 0; k < channels; ++k) {
+                        if (!box) {
+                            auto *src = img.ptr<uint8_t>(r * scale);
+                            out.ptr<uint8_t>(r)[c * channels + k] = src[c * scale * channels + k];
+                            continue;
+                        }
+                        unsigned sum = 0, count = rows * cols;
+                        for (int i = 0; i < rows; ++i) {
+                            for (int j = 0; j < cols; ++j) {
+                                sum += img.ptr<uint8_t>(r * scale + i)[(c * scale + j) * channels + k];
+                            }
+                        }
+                        out.ptr<uint8_t>(r)[c * channels + k] = static_cast<uint8_t>((sum + count / 2) / count);
+                    }
+                }
+            }
+            return out;
+        };
+        cv::Mat odd(67, 101, CV_8UC3);
+        cv::randu(odd, 0, 256);
+        std::vector<cv::Mat> images(pngImages);
+        images.push_back(odd);
+        std::vector<std::string> encoded;
+        std::size_t imagesSize = 0;
+        for (auto &img : images) {
+            imagesSize += img.total() * img.elemSize();
+            std::ostringstream os;
+            if (img.channels() == 4) {
+                os << cvqoi::Encoder<true>(img);
+            }
+            else {
+                os << cvqoi::Encoder<>(img);
+            }
+            encoded.push_back(os.str());
+        }
+        for (uint32_t scale : {1u, 2u, 3u, 8u}) {
+            std::chrono::duration<double> boxTime{0}, sampleTime{0}, resizeTime{0};
+            for (std::size_t i = 0; i < images.size(); ++i) {
+                auto *data = reinterpret_cast<const uint8_t*>(encoded[i].data());
+                cv::Mat box, sample, full, resized;
+                auto start = std::chrono::steady_clock::now();
+                cvqoi::Decoder::decodeScaled(data, encoded[i].size(), scale, box);
+                boxTime += std::chrono::steady_clock::now() - start;
+                start = std::chrono::steady_clock::now();
+                cvqoi::Decoder::decodeScaled(data, encoded[i].size(), scale, sample, cvqoi::Decoder::Downscale::Sample);
+                sampleTime += std::chrono::steady_clock::now() - start;
+                start = std::chrono::steady_clock::now();
+                cvqoi::Decoder::decode(data, encoded[i].size(), full);
+                cv::resize(full, resized, box.size(), 0, 0, cv::INTER_AREA);
+                resizeTime += std::chrono::steady_clock::now() - start;
+                int s = static_cast<int>(scale);
+                if (cv::norm(box, reference(images[i], s, true), cv::NORM_INF) != 0
+                    || cv::norm(sample, reference(images[i], s, false), cv::NORM_INF) != 0) {
+                    std::cout << "Scaled decoding by " << scale << " failed for image " << i << std::endl;
+                    return 1;
+                }
+            }
+            std::cout << "Scaled decode 1/" << scale << ", ";
+            std::cout << "Box: " << imagesSize / 1e6 / boxTime.count() << " MB/s, ";
+            std::cout << "Sample: " << imagesSize / 1e6 / sampleTime.count() << " MB/s, ";
+            std::cout << "decode + cv::resize: " << imagesSize / 1e6 / resizeTime.count() << " MB/s" << std::endl;
+        }
+    }
+
+    //Near-lossless: standard QOI the reference decoder reads, every channel within the bound of the source
+    std::size_t losslessSize = 0, sourceSize = 0;
+    for (std::size_t i = 0; i < pngImages.size(); ++i) {
+        losslessSize += cvQoiImages[i].size();
+        sourceSize += pngImages[i].total() * pngImages[i].elemSize();
+    }
+    for (uint8_t bound : {1, 2}) {
+        std::size_t encodedSize = 0;
+        std::chrono::duration<double> elapsed{0};
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            std::ostringstream os;
+            auto start = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                os << cvqoi::Encoder<true>(pngImages[i]).nearLossless(bound);
+            }
+            else {
+                os << cvqoi::Encoder<>(pngImages[i]).nearLossless(bound);
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+            auto encoded = os.str();
+            encodedSize += encoded.size();
+
+            qoi_desc qd;
+            auto *decodedImg = qoi_decode(encoded.data(), static_cast<int>(encoded.size()), &qd, 0);
+            if (decodedImg == nullptr || qd.channels != pngImages[i].channels()) {
+                std::cout << "Reference decoder can not read near-lossless " << pngFiles[i].filename() << std::endl;
+                free(decodedImg);
+                return 1;
+            }
+            cv::Mat decoded;
+            cv::cvtColor(cv::Mat(qd.height, qd.width, CV_8UC(qd.channels), decodedImg), decoded,
+                         qd.channels == 4 ? cv::COLOR_RGBA2BGRA : cv::COLOR_RGB2BGR);
+            free(decodedImg);
+            if (cv::norm(decoded, pngImages[i], cv::NORM_INF) > bound) {
+                std::cout << "Near-lossless error over " << +bound << " for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Near-lossless +-" << +bound << ": ";
+        std::cout << "Size: " << encodedSize << " (" << 100.0 * encodedSize / losslessSize << "% of lossless), ";
+        std::cout << "Encode: " << sourceSize / 1e6 / elapsed.count() << " MB/s" << std::endl;
+    }
+
+    //Compression ratio and encode speed of each pre-filter over the whole corpus
+    const std::pair<cvqoi::Filter, const char*> filters[] = {{cvqoi::Filter::None, "None"}, 
+                                                             {cvqoi::Filter::YCoCgR, "YCoCg-R"}, 
+                                                             {cvqoi::Filter::Vertical, "Vertical"}};
+    std::size_t rawSize = 0;
+    for (auto &img : pngImages) {
+        rawSize += img.total() * img.elemSize();
+    }
+    for (auto &f : filters) {
+        std::size_t encodedSize = 0;
+        std::chrono::duration<double> elapsed{0};
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            std::vector<char> encoded;
+            bstrs::back_insert_device<std::vector<char>> sink{encoded};
+            bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+            auto start = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                os << cvqoi::Encoder<true>(pngImages[i]).filter(f.first);
+            }
+            else {
+                os << cvqoi::Encoder<>(pngImages[i]).filter(f.first);
+            }
+            os.flush();
+            elapsed += std::chrono::steady_clock::now() - start;
+            encodedSize += encoded.size();
+
+            cv::Mat decoded;
+            cvqoi::Decoder::decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), decoded);
+            if (cv::norm(decoded, pngImages[i], cv::NORM_INF) != 0) {
+                std::cout << "Filter " << f.second << " round trip failed for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Filter: " << f.second << ", ";
+        std::cout << "Size: " << encodedSize << " (" << 100.0 * encodedSize / rawSize << "% of raw), ";
+        std::cout << "Encode: " << rawSize / 1e6 / elapsed.count() << " MB/s" << std::endl;
+    }
+
+    //Standard vs. large index profile, over the corpus and a generated 1000 color palette map
+    cv::Mat palette(1024, 1024, CV_8UC3);
+    cv::RNG rng(42);
+    std::vector<cv::Vec3b> colors(1000);
+    for (auto &c : colors) {
+        c = cv::Vec3b(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+    }
+    for (int r = 0; r < palette.rows; ++r) {
+        for (int c = 0; c < palette.cols; ++c) {
+            palette.at<cv::Vec3b>(r, c) = colors[((r / 8) * 131 + (c / 4) * 17 + (r * c) % 7) % colors.size()];
+        }
+    }
+    const std::pair<std::vector<cv::Mat>, const char*> sets[] = {{pngImages, "Corpus"}, {{palette}, "Palette"}};
+    for (auto &set : sets) {
+        std::size_t setSize = 0;
+        for (auto &img : set.first) {
+            setSize += img.total() * img.elemSize();
+        }
+        for (bool large : {false, true}) {
+            std::size_t encodedSize = 0;
+            std::chrono::duration<double> encodeTime{0}, decodeTime{0};
+            for (auto &img : set.first) {
+                std::vector<char> encoded;
+                bstrs::back_insert_device<std::vector<char>> sink{encoded};
+                bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+                auto start = std::chrono::steady_clock::now();
+                if (img.channels() == 4) {
+                    os << cvqoi::Encoder<true>(img).largeIndex(large);
+                }
+                else {
+                    os << cvqoi::Encoder<>(img).largeIndex(large);
+                }
+                os.flush();
+                encodeTime += std::chrono::steady_clock::now() - start;
+                encodedSize += encoded.size();
+
+                cv::Mat decoded;
+                start = std::chrono::steady_clock::now();
+                cvqoi::Decoder::decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), decoded);
+                decodeTime += std::chrono::steady_clock::now() - start;
+                if (cv::norm(decoded, img, cv::NORM_INF) != 0) {
+                    std::cout << "Large index round trip failed" << std::endl;
+                    return 1;
+                }
+            }
+            std::cout << set.second << (large ? " large index: " : " standard: ");
+            std::cout << "Size: " << encodedSize << " (" << 100.0 * encodedSize / setSize << "% of raw), ";
+            std::cout << "Encode: " << setSize / 1e6 / encodeTime.count() << " MB/s, ";
+            std::cout << "Decode: " << setSize / 1e6 / decodeTime.count() << " MB/s" << std::endl;
+        }
+    }
+
+    //Dictionary trained on every other 16x16 tile of the corpus, measured on the rest
+    std::vector<cv::Mat> trainTiles, testTiles;
+    for (auto &img : pngImages) {
+        for (int r = 0; r + 16 <= img.rows; r += 16) {
+            for (int c = 0; c + 16 <= img.cols; c += 16) {
+                auto tile = img(cv::Rect(c, r, 16, 16)).clone();
+                if (tile.channels() == 4) {
+                    cv::cvtColor(tile, tile, cv::COLOR_BGRA2BGR);
+                }
+                ((r + c) / 16 % 2 ? testTiles : trainTiles).push_back(tile);
+            }
+        }
+    }
+    auto dict = cvqoi::Dictionary::train(1, trainTiles);
+    cvqoi::Dictionary::add(dict);
+    std::size_t plainSize = 0, primedSize = 0;
+    for (auto &tile : testTiles) {
+        std::vector<char> plain, primed;
+        bstrs::back_insert_device<std::vector<char>> plainSink{plain}, primedSink{primed};
+        bstrs::stream<bstrs::back_insert_device<std::vector<char>>> plainOs{plainSink}, primedOs{primedSink};
+        plainOs << cvqoi::Encoder<>(tile);
+        primedOs << cvqoi::Encoder<>(tile).dictionary(dict);
+        plainOs.flush();
+        primedOs.flush();
+        plainSize += plain.size();
+        primedSize += primed.size();
+
+        cv::Mat decoded;
+        cvqoi::Decoder::decode(reinterpret_cast<const uint8_t*>(primed.data()), primed.size(), decoded);
+        if (cv::norm(decoded, tile, cv::NORM_INF) != 0) {
+            std::cout << "Dictionary round trip failed" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Dictionary on " << testTiles.size() << " tiles of 16x16, ";
+    std::cout << "Size without: " << plainSize << ", with: " << primedSize << std::endl;
+
+    //Same tiles through the Encoder and the compile time sized batch encoder
+    std::vector<const uint8_t*> tilePtrs;
+    for (auto &tile : testTiles) {
+        tilePtrs.push_back(tile.data);
+    }
+    std::vector<char> streamed;
+    auto start = std::chrono::steady_clock::now();
+    {
+        bstrs::back_insert_device<std::vector<char>> sink{streamed};
+        bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+        for (auto &tile : testTiles) {
+            os << cvqoi::Encoder<>(tile);
+        }
+    }
+    std::chrono::duration<double> streamTime = std::chrono::steady_clock::now() - start;
+    std::vector<uint8_t> batch;
+    std::vector<std::size_t> ends;
+    start = std::chrono::steady_clock::now();
+    cvqoi::encodeFixedBatch<16, 16, 3>(tilePtrs.data(), tilePtrs.size(), 16 * 3, batch, ends);
+    std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - start;
+    if (!std::equal(batch.begin(), batch.end(), streamed.begin(), streamed.end(),
+                    [](uint8_t a, char b) { return a == static_cast<uint8_t>(b); })) {
+        std::cout << "Fixed size encoding differs from the Encoder" << std::endl;
+        return 1;
+    }
+    std::cout << "Tiles per second, Encoder: " << testTiles.size() / streamTime.count();
+    std::cout << ", encodeFixedBatch: " << testTiles.size() / batchTime.count() << std::endl;
+
+    //Transforms against encoding a cv::rotate/flip/transpose copy
+    const std::pair<cvqoi::Transform, const char*> transforms[] = {{cvqoi::Transform::Rotate90, "Rotate90"},
+                                                                   {cvqoi::Transform::Rotate180, "Rotate180"},
+                                                                   {cvqoi::Transform::Rotate270, "Rotate270"},
+                                                                   {cvqoi::Transform::FlipHorizontal, "FlipHorizontal"},
+                                                                   {cvqoi::Transform::FlipVertical, "FlipVertical"},
+                                                                   {cvqoi::Transform::Transpose, "Transpose"}};
+    for (auto &t : transforms) {
+        std::chrono::duration<double> direct{0}, copied{0};
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            auto &img = pngImages[i];
+            std::vector<char> a, b;
+            bstrs::back_insert_device<std::vector<char>> sinkA{a}, sinkB{b};
+            bstrs::stream<bstrs::back_insert_device<std::vector<char>>> osA{sinkA}, osB{sinkB};
+            auto start = std::chrono::steady_clock::now();
+            if (img.channels() == 4) {
+                osA << cvqoi::Encoder<true>(img).transform(t.first);
+            }
+            else {
+                osA << cvqoi::Encoder<>(img).transform(t.first);
+            }
+            osA.flush();
+            direct += std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            cv::Mat transformed;
+            switch (t.first) {
+                case cvqoi::Transform::Rotate90: cv::rotate(img, transformed, cv::ROTATE_90_CLOCKWISE); break;
+                case cvqoi::Transform::Rotate180: cv::rotate(img, transformed, cv::ROTATE_180); break;
+                case cvqoi::Transform::Rotate270: cv::rotate(img, transformed, cv::ROTATE_90_COUNTERCLOCKWISE); break;
+                case cvqoi::Transform::FlipHorizontal: cv::flip(img, transformed, 1); break;
+                case cvqoi::Transform::FlipVertical: cv::flip(img, transformed, 0); break;
+                default: cv::transpose(img, transformed); break;
+            }
+            if (img.channels() == 4) {
+                osB << cvqoi::Encoder<true>(transformed);
+            }
+            else {
+                osB << cvqoi::Encoder<>(transformed);
+            }
+            osB.flush();
+            copied += std::chrono::steady_clock::now() - start;
+            if (a != b) {
+                std::cout << "Transform " << t.second << " differs for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Transform: " << t.second << ", ";
+        std::cout << "Encode: " << rawSize / 1e6 / direct.count() << " MB/s, ";
+        std::cout << "transformed copy + encode: " << rawSize / 1e6 / copied.count() << " MB/s" << std::endl;
+    }
+
+    //16-bit: the corpus scaled to 12 bits, WideEncoder against 16-bit PNG
+    std::size_t wideRaw = 0, wideSize = 0, pngSize = 0;
+    std::chrono::duration<double> wideEncode{0}, wideDecode{0}, pngEncode{0}, pngDecode{0};
+    for (auto &img : pngImages) {
+        cv::Mat wide, decoded;
+        img.convertTo(wide, CV_16U, 16.0);
+        wideRaw += wide.total() * wide.elemSize();
+
+        std::ostringstream os;
+        auto start = std::chrono::steady_clock::now();
+        os << cvqoi::WideEncoder(wide);
+        auto encoded = os.str();
+        wideEncode += std::chrono::steady_clock::now() - start;
+        wideSize += encoded.size();
+        start = std::chrono::steady_clock::now();
+        cvqoi::Decoder::decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), decoded);
+        wideDecode += std::chrono::steady_clock::now() - start;
+        if (cv::norm(decoded, wide, cv::NORM_INF) != 0) {
+            std::cout << "16-bit round trip failed" << std::endl;
+            return 1;
+        }
+
+        std::vector<uint8_t> png;
+        start = std::chrono::steady_clock::now();
+        cv::imencode(".png", wide, png);
+        pngEncode += std::chrono::steady_clock::now() - start;
+        pngSize += png.size();
+        start = std::chrono::steady_clock::now();
+        decoded = cv::imdecode(png, cv::IMREAD_UNCHANGED);
+        pngDecode += std::chrono::steady_clock::now() - start;
+    }
+    std::cout << "16-bit CVQoi: " << 100.0 * wideSize / wideRaw << "% of raw, ";
+    std::cout << "Encode: " << wideRaw / 1e6 / wideEncode.count() << " MB/s, ";
+    std::cout << "Decode: " << wideRaw / 1e6 / wideDecode.count() << " MB/s" << std::endl;
+    std::cout << "16-bit PNG: " << 100.0 * pngSize / wideRaw << "% of raw, ";
+    std::cout << "Encode: " << wideRaw / 1e6 / pngEncode.count() << " MB/s, ";
+    std::cout << "Decode: " << wideRaw / 1e6 / pngDecode.count() << " MB/s" << std::endl;
+
+    //Interlaced vs. scan order, and how much of an interlaced stream a first preview needs
+    for (bool interlaced : {false, true}) {
+        std::size_t encodedSize = 0, previewSize = 0;
+        std::chrono::duration<double> elapsed{0};
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            std::vector<char> encoded;
+            bstrs::back_insert_device<std::vector<char>> sink{encoded};
+            bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+            auto start = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                os << cvqoi::Encoder<true>(pngImages[i]).interlaced(interlaced);
+            }
+            else {
+                os << cvqoi::Encoder<>(pngImages[i]).interlaced(interlaced);
+            }
+            os.flush();
+            elapsed += std::chrono::steady_clock::now() - start;
+            encodedSize += encoded.size();
+
+            cv::Mat decoded;
+            auto *data = reinterpret_cast<const uint8_t*>(encoded.data());
+            cvqoi::Decoder::decode(data, encoded.size(), decoded);
+            if (cv::norm(decoded, pngImages[i], cv::NORM_INF) != 0) {
+                std::cout << "Interlaced round trip failed for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+            if (interlaced) {
+                //Smallest prefix that completes the first pass
+                std::size_t lo = cvqoi::container::HEADER_SIZE + cvqoi::qoi::HEADER_SIZE, hi = encoded.size();
+                while (lo < hi) {
+                    auto mid = lo + (hi - lo) / 2;
+                    if (cvqoi::Decoder::decodeProgressive(data, mid, decoded) >= 1) {
+                        hi = mid;
+                    }
+                    else {
+                        lo = mid + 1;
+                    }
+                }
+                previewSize += lo;
+            }
+        }
+        std::cout << (interlaced ? "Interlaced: " : "Scan order: ");
+        std::cout << "Size: " << encodedSize << " (" << 100.0 * encodedSize / rawSize << "% of raw), ";
+        std::cout << "Encode: " << rawSize / 1e6 / elapsed.count() << " MB/s";
+        if (interlaced) {
+            std::cout << ", first preview after " << 100.0 * previewSize / encodedSize << "% of the bytes";
+        }
+        std::cout << std::endl;
+    }
+
+    //Stripe-parallel encoding has to give the same bytes as serial
+    for (uint32_t stripes : {2u, 4u, 8u}) {
+        std::chrono::duration<double> elapsed{0};
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            std::ostringstream os;
+            auto start = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                os << cvqoi::Encoder<true>(pngImages[i]).stripes(stripes);
+            }
+            else {
+                os << cvqoi::Encoder<>(pngImages[i]).stripes(stripes);
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+            auto encoded = os.str();
+            if (!std::equal(encoded.begin(), encoded.end(), cvQoiImages[i].begin(), cvQoiImages[i].end())) {
+                std::cout << stripes << " stripes differ from serial for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Stripes: " << stripes << ", Encode: " << rawSize / 1e6 / elapsed.count() << " MB/s" << std::endl;
+    }
+    for (auto &empty : {cv::Mat(5, 0, CV_8UC3), cv::Mat(0, 5, CV_8UC3)}) {
+        std::ostringstream serial, striped;
+        serial << cvqoi::Encoder<>(empty);
+        striped << cvqoi::Encoder<>(empty).stripes(4);
+        if (serial.str() != striped.str()) {
+            std::cout << "Stripes differ from serial for a " << empty.cols << "x" << empty.rows << " image";
+            std::cout << std::endl;
+            return 1;
+        }
+    }
+
+    //Checksum trailer: encode cost, and verify vs. decode speed for a scrubber
+    {
+        std::vector<std::string> checked(pngImages.size());
+        std::chrono::duration<double> plainTime{0}, checkedTime{0}, verifyTime{0}, decodeTime{0};
+        std::size_t checkedSize = 0;
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            std::ostringstream plain, os;
+            auto start = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                plain << cvqoi::Encoder<true>(pngImages[i]);
+            }
+            else {
+                plain << cvqoi::Encoder<>(pngImages[i]);
+            }
+            auto mid = std::chrono::steady_clock::now();
+            if (pngImages[i].channels() == 4) {
+                os << cvqoi::Encoder<true>(pngImages[i]).checksum();
+            }
+            else {
+                os << cvqoi::Encoder<>(pngImages[i]).checksum();
+            }
+            auto end = std::chrono::steady_clock::now();
+            plainTime += mid - start;
+            checkedTime += end - mid;
+            checked[i] = os.str();
+            checkedSize += checked[i].size();
+        }
+        for (std::size_t i = 0; i < checked.size(); ++i) {
+            auto *data = reinterpret_cast<const uint8_t*>(checked[i].data());
+            cv::Mat decoded;
+            auto start = std::chrono::steady_clock::now();
+            auto integrity = cvqoi::Decoder::verify(data, checked[i].size());
+            auto mid = std::chrono::steady_clock::now();
+            cvqoi::Decoder::decode(data, checked[i].size(), decoded);
+            auto end = std::chrono::steady_clock::now();
+            verifyTime += mid - start;
+            decodeTime += end - mid;
+            auto corrupt = checked[i];
+            corrupt[corrupt.size() / 2] ^= 1;
+            if (integrity != cvqoi::Integrity::Valid
+                || cvqoi::Decoder::verify(reinterpret_cast<const uint8_t*>(corrupt.data()), corrupt.size())
+                   != cvqoi::Integrity::Corrupt
+                || cv::norm(decoded, pngImages[i], cv::NORM_INF) != 0) {
+                std::cout << "Checksum check failed for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Checksum: Encode: " << rawSize / 1e6 / checkedTime.count() << " MB/s ";
+        std::cout << "(without: " << rawSize / 1e6 / plainTime.count() << " MB/s), ";
+        std::cout << "Verify: " << checkedSize / 1e6 / verifyTime.count() << " MB/s of stream, ";
+        std::cout << "Decode: " << checkedSize / 1e6 / decodeTime.count() << " MB/s of stream" << std::endl;
+    }
+
+    //Post-compression with FastLZ, tiny and default blocks, and how much it takes off the encoded size
+    std::vector<std::size_t> compressedSizes(cvQoiImages.size());
+    for (uint32_t blockSize : {7u, cvqoi::postcompress::DEFAULT_BLOCK_SIZE}) {
+        std::size_t encodedSize = 0, compressedSize = 0;
+        std::chrono::duration<double> compressTime{0}, decompressTime{0};
+        for (std::size_t i = 0; i < cvQoiImages.size(); ++i) {
+            std::ostringstream os;
+            auto start = std::chrono::steady_clock::now();
+            {
+                cvqoi::CompressedWriter writer(os, std::make_unique<cvqoi::postcompress::FastLZ>(), blockSize);
+                writer.stream().write(cvQoiImages[i].data(), cvQoiImages[i].size());
+                writer.finish();
+            }
+            compressTime += std::chrono::steady_clock::now() - start;
+            auto compressed = os.str();
+            encodedSize += cvQoiImages[i].size();
+            compressedSize += compressed.size();
+            if (blockSize == cvqoi::postcompress::DEFAULT_BLOCK_SIZE) {
+                compressedSizes[i] = compressed.size();
+            }
+
+            std::istringstream is(compressed);
+            start = std::chrono::steady_clock::now();
+            auto restored = cvqoi::CompressedReader::read(is);
+            decompressTime += std::chrono::steady_clock::now() - start;
+            if (!std::equal(restored.begin(), restored.end(), cvQoiImages[i].begin(), cvQoiImages[i].end(),
+                            [](uint8_t a, char b) { return a == static_cast<uint8_t>(b); })) {
+                std::cout << "FastLZ round trip failed with " << blockSize << " byte blocks for ";
+                std::cout << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "FastLZ, " << blockSize << " byte blocks: ";
+        std::cout << "Size: " << compressedSize << " (" << 100.0 * compressedSize / encodedSize << "% of QOI, ";
+        std::cout << 100.0 * compressedSize / rawSize << "% of raw), ";
+        std::cout << "Compress: " << encodedSize / 1e6 / compressTime.count() << " MB/s, ";
+        std::cout << "Decompress: " << encodedSize / 1e6 / decompressTime.count() << " MB/s" << std::endl;
+    }
+
+#ifdef CVQOI_TRACE
+    cvqoi::trace::dump("cvqoi_trace.json");
+    std::cout << "Timing spans written to cvqoi_trace.json" << std::endl;
+#endif
+
     for (std::size_t i = 0; i < qoiImages.size(); ++i) {
         std::cout << "File Name: " << qoiFiles[i].filename() << ", ";
         std::cout << "Reference QOI size: " << qoiImages[i].size() << ", ";
-        std::cout << "CVQoi size: " << cvQoiImages[i].size() << std::endl;
+        std::cout << "CVQoi size: " << cvQoiImages[i].size() << ", ";
+        std::cout << "FastLZ size: " << compressedSizes[i] << " (";
+        std::cout << 100.0 * compressedSizes[i] / cvQoiImages[i].size() << "% of CVQoi, ";
+        std::cout << 100.0 * compressedSizes[i] / (pngImages[i].total() * pngImages[i].elemSize());
+        std::cout << "% of raw)" << std::endl;
     }
 
     for (std::size_t i = 0; i < qoiImages.size(); ++i) {
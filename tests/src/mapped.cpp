@@ -0,0 +1,205 @@
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/Archive.hpp"
+#include "cvqoi/Loader.hpp"
+#include "cvqoi/MappedRawSource.hpp"
+
+namespace bfs = boost::filesystem;
+
+// Archive, Loader and MappedRawSource, the parts built on POSIX file mapping. Kept out of main.cpp
+// so the main test program still builds everywhere.
+//
+//     cvqoimappedtest <qoi_test_images>
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Please give path to the qoi_test_images as an argument to the program!" << std::endl;
+        return 1;
+    }
+    std::vector<bfs::path> pngFiles;
+    for (auto &x : bfs::directory_iterator(argv[1])) {
+        if (x.path().extension() == ".png") {
+            pngFiles.push_back(x.path());
+        }
+    }
+    if (pngFiles.empty()) {
+        std::cout << "There are no png files inside " << argv[1] << "!" << std::endl;
+        return 1;
+    }
+    std::sort(pngFiles.begin(), pngFiles.end());
+    std::vector<cv::Mat> pngImages;
+    for (auto &p : pngFiles) {
+        pngImages.push_back(cv::imread(p.string(), cv::IMREAD_UNCHANGED));
+    }
+
+    //One .qoi file per image, what the archive and the Loader are compared with
+    std::vector<std::string> files;
+    for (std::size_t i = 0; i < pngImages.size(); ++i) {
+        files.push_back((bfs::temp_directory_path() / ("cvqoimapped" + std::to_string(i) + ".qoi")).string());
+        std::ofstream os(files.back(), std::ios::binary);
+        if (pngImages[i].channels() == 4) {
+            os << cvqoi::Encoder<true>(pngImages[i]);
+        }
+        else {
+            os << cvqoi::Encoder<>(pngImages[i]);
+        }
+    }
+
+    //Row sources: a raw file through MappedRawSource and a lambda, 7 row bands so the last one is partial
+    {
+        auto str = [](const auto &e) {
+            std::ostringstream os;
+            os << e;
+            return os.str();
+        };
+        auto rawPath = (bfs::temp_directory_path() / "cvqoitest.raw").string();
+        for (std::size_t i = 0; i < pngImages.size(); ++i) {
+            auto &img = pngImages[i];
+            {
+                std::ofstream os(rawPath, std::ios::binary);
+                for (int r = 0; r < img.rows; ++r) {
+                    os.write(reinterpret_cast<const char*>(img.ptr(r)), img.cols * img.elemSize());
+                }
+            }
+            auto w = static_cast<uint32_t>(img.cols), h = static_cast<uint32_t>(img.rows);
+            cvqoi::MappedRawSource mapped(rawPath, w, h, img.channels());
+            cvqoi::RowSource lambda = [&img](uint32_t first, uint32_t count, uint8_t *dst, size_t stride) {
+                for (uint32_t r = 0; r < count; ++r) {
+                    std::memcpy(dst + r * stride, img.ptr(first + r), img.cols * img.elemSize());
+                }
+            };
+            for (uint32_t interval : {0u, 16u}) {
+                std::string direct, fromMapped, fromLambda;
+                if (img.channels() == 4) {
+                    direct = str(cvqoi::Encoder<true>(img).rowIndex(interval));
+                    fromMapped = str(cvqoi::Encoder<true>(std::cref(mapped), w, h, 7).rowIndex(interval));
+                    fromLambda = str(cvqoi::Encoder<true>(lambda, w, h, 7).rowIndex(interval));
+                }
+                else {
+                    direct = str(cvqoi::Encoder<>(img).rowIndex(interval));
+                    fromMapped = str(cvqoi::Encoder<>(std::cref(mapped), w, h, 7).rowIndex(interval));
+                    fromLambda = str(cvqoi::Encoder<>(lambda, w, h, 7).rowIndex(interval));
+                }
+                if (fromMapped != direct || fromLambda != direct) {
+                    std::cout << "RowSource encoding differs for " << pngFiles[i].filename() << std::endl;
+                    return 1;
+                }
+            }
+        }
+        bfs::remove(rawPath);
+        std::cout << "Successfully encoded all PNG Images through RowSources" << std::endl;
+    }
+
+    //Archive: every image back out of one mapped file, random order against opening one file per image
+    auto archivePath = (bfs::temp_directory_path() / "cvqoitest.qoia").string();
+    {
+        std::ofstream os(archivePath, std::ios::binary);
+        cvqoi::ArchiveBuilder builder(os);
+        for (auto &img : pngImages) {
+            builder.append(img);
+        }
+        builder.finish();
+    }
+    {
+        cvqoi::ArchiveReader archive(archivePath);
+        if (archive.size() != pngImages.size()) {
+            std::cout << "Archive holds " << archive.size() << " images instead of " << pngImages.size() << std::endl;
+            return 1;
+        }
+        std::vector<std::size_t> order(pngImages.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937(7));
+        std::chrono::duration<double> archiveTime{0}, filesTime{0};
+        for (auto i : order) {
+            cv::Mat fromArchive, fromFile;
+            auto start = std::chrono::steady_clock::now();
+            archive.decode(i, fromArchive);
+            archiveTime += std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            std::ifstream is(files[i], std::ios::binary);
+            std::vector<char> encoded{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+            cvqoi::Decoder::decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), fromFile);
+            filesTime += std::chrono::steady_clock::now() - start;
+            if (cv::norm(fromArchive, pngImages[i], cv::NORM_INF) != 0 
+                || cv::norm(fromFile, pngImages[i], cv::NORM_INF) != 0) {
+                std::cout << "Archive round trip failed for " << pngFiles[i].filename() << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Archive, random order: " << order.size() / archiveTime.count() << " images/s, ";
+        std::cout << "one file per image: " << order.size() / filesTime.count() << " images/s" << std::endl;
+    }
+    //Loader over the archive in random order and over the single files, for a few pool sizes
+    {
+        cvqoi::ArchiveReader archive(archivePath);
+        std::vector<std::size_t> order(pngImages.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937(11));
+        for (std::size_t threads : {1, 4}) {
+            for (std::size_t prefetch : {1, 8}) {
+                for (bool fromArchive : {true, false}) {
+                    auto loader = fromArchive ? std::make_unique<cvqoi::Loader>(archive, order, threads, prefetch)
+                                              : std::make_unique<cvqoi::Loader>(files, threads, prefetch);
+                    std::size_t n = 0, maxDepth = 0;
+                    while (auto *image = loader->next()) {
+                        auto i = fromArchive ? order[n] : n;
+                        if (cv::norm(*image, pngImages[i], cv::NORM_INF) != 0) {
+                            std::cout << "Loader returned the wrong image at position " << n << std::endl;
+                            return 1;
+                        }
+                        maxDepth = std::max(maxDepth, loader->stats().queueDepth);
+                        ++n;
+                    }
+                    if (n != pngImages.size()) {
+                        std::cout << "Loader returned " << n << " images instead of " << pngImages.size() << std::endl;
+                        return 1;
+                    }
+                    auto stats = loader->stats();
+                    std::cout << "Loader, " << (fromArchive ? "archive" : "files") << ", " << threads << " threads, ";
+                    std::cout << "prefetch " << prefetch << ": queue depth up to " << maxDepth << ", ";
+                    std::cout << "stalled " << stats.stallSeconds << " s, " << stats.imagesPerSecond << " images/s";
+                    std::cout << std::endl;
+                }
+            }
+        }
+
+        //A file that can not be read fails at its own position, after the images before it
+        auto missing = files;
+        missing.insert(missing.begin() + 1, (bfs::temp_directory_path() / "cvqoi_missing.qoi").string());
+        cvqoi::Loader loader(missing, 2, 4);
+        std::size_t before = 0;
+        bool thrown = false;
+        try {
+            while (loader.next()) {
+                ++before;
+            }
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        if (!thrown || before != 1) {
+            std::cout << "Loader did not rethrow the error for a missing file" << std::endl;
+            return 1;
+        }
+    }
+    bfs::remove(archivePath);
+
+    for (auto &f : files) {
+        bfs::remove(f);
+    }
+    return 0;
+}
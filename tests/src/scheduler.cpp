@@ -0,0 +1,107 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/Scheduler.hpp"
+
+namespace bfs = boost::filesystem;
+
+// cvqoi::Scheduler against a plain serial loop, on the corpus as a batch and on each image alone.
+// Every output is checked against the serial encoding.
+//
+//     cvqoischedulerbench <qoi_test_images> [threads] [cache file]
+
+std::string serial(const cv::Mat &mat) {
+    std::ostringstream os;
+    if (mat.channels() == 4) {
+        os << cvqoi::Encoder<true>(mat);
+    }
+    else {
+        os << cvqoi::Encoder<>(mat);
+    }
+    return os.str();
+}
+
+bool same(const std::vector<char> &encoded, const std::string &expected) {
+    return std::equal(encoded.begin(), encoded.end(), expected.begin(), expected.end());
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Please give path to the qoi_test_images as an argument to the program!" << std::endl;
+        return 1;
+    }
+    unsigned threads = argc > 2 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+    std::string cache = argc > 3 ? argv[3] : cvqoi::Scheduler::defaultCachePath();
+
+    std::vector<cv::Mat> images;
+    for (auto &x : bfs::directory_iterator(argv[1])) {
+        if (x.path().extension() == ".png") {
+            images.push_back(cv::imread(x.path().string(), cv::IMREAD_UNCHANGED));
+        }
+    }
+    if (images.empty()) {
+        std::cout << "There are no png files inside " << argv[1] << "!" << std::endl;
+        return 1;
+    }
+    std::size_t rawSize = 0;
+    for (auto &img : images) {
+        rawSize += img.total() * img.elemSize();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    cvqoi::Scheduler scheduler(threads, cache);
+    std::chrono::duration<double> setup = std::chrono::steady_clock::now() - start;
+    auto stripeBytes = scheduler.thresholds().stripeBytes;
+    auto batchBytes = scheduler.thresholds().batchBytes;
+    std::cout << threads << " threads, set up in " << setup.count() << " s, ";
+    if (stripeBytes == UINT64_MAX) {
+        std::cout << "stripes never pay off, ";
+    }
+    else {
+        std::cout << "stripes from " << stripeBytes << " bytes, ";
+    }
+    if (batchBytes == UINT64_MAX) {
+        std::cout << "parallel batches never pay off" << std::endl;
+    }
+    else {
+        std::cout << "parallel batches from " << batchBytes << " bytes per image" << std::endl;
+    }
+
+    std::vector<std::string> expected(images.size());
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        expected[i] = serial(images[i]);
+    }
+    std::chrono::duration<double> serialTime = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::vector<char>> batch;
+    start = std::chrono::steady_clock::now();
+    scheduler.encode(images, batch);
+    std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - start;
+
+    std::chrono::duration<double> singleTime{0};
+    std::vector<char> single;
+    std::size_t striped = 0;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        start = std::chrono::steady_clock::now();
+        scheduler.encode(images[i], single);
+        singleTime += std::chrono::steady_clock::now() - start;
+        striped += scheduler.choose(images[i].total() * images[i].elemSize(), 1) == cvqoi::Scheduler::Mode::Stripes;
+        if (!same(single, expected[i]) || !same(batch[i], expected[i])) {
+            std::cout << "Scheduled encoding differs from serial for image " << i << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Serial: " << rawSize / 1e6 / serialTime.count() << " MB/s" << std::endl;
+    std::cout << "Scheduler, whole corpus as one batch: " << rawSize / 1e6 / batchTime.count() << " MB/s" << std::endl;
+    std::cout << "Scheduler, one image at a time (" << striped << " of " << images.size() << " striped): ";
+    std::cout << rawSize / 1e6 / singleTime.count() << " MB/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/ShmRing.hpp"
+
+// Producer/consumer test and latency benchmark for cvqoi::ShmRing. The parent process encodes
+// frames into the ring, a forked child decodes them in place, checks them and reports the
+// latency from publish to acquire.
+
+cv::Mat makeFrame(int rows, int cols, uint64_t n) {
+    cv::Mat mat(rows, cols, CV_8UC3);
+    for (int r = 0; r < rows; ++r) {
+        auto *row = mat.ptr<uint8_t>(r);
+        for (int c = 0; c < cols * 3; ++c) {
+            row[c] = static_cast<uint8_t>((r / 8 + c / 24 + n) * 37);
+        }
+    }
+    return mat;
+}
+
+int consume(const std::string &name, int rows, int cols, uint64_t frames) {
+    auto ring = cvqoi::ShmRing::open(name);
+    std::vector<double> latencies;
+    latencies.reserve(frames);
+    cv::Mat decoded;
+    for (uint64_t n = 0; n < frames; ++n) {
+        auto frame = ring.acquire();
+        std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - frame.published;
+        latencies.push_back(latency.count());
+        cvqoi::Decoder::decode(frame.data, frame.size, decoded);
+        ring.release(frame);
+
+        auto expected = makeFrame(rows, cols, n);
+        for (int r = 0; r < rows; ++r) {
+            if (std::memcmp(decoded.ptr(r), expected.ptr(r), cols * 3) != 0) {
+                std::cout << "Frame " << n << " does not match what was published!" << std::endl;
+                return 1;
+            }
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Received " << frames << " frames, publish to acquire latency: "
+              << "p50 " << latencies[latencies.size() / 2] << " us, "
+              << "p99 " << latencies[latencies.size() * 99 / 100] << " us, "
+              << "max " << latencies.back() << " us" << std::endl;
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    int rows = argc > 1 ? std::stoi(argv[1]) : 480;
+    int cols = argc > 2 ? std::stoi(argv[2]) : 640;
+    uint64_t frames = argc > 3 ? std::stoull(argv[3]) : 1000;
+    std::string name = "/cvqoi_ring_test_" + std::to_string(::getpid());
+
+    auto first = makeFrame(rows, cols, 0);
+    auto ring = cvqoi::ShmRing::create(name, 4, cvqoi::Encoder<>(first).maxSize());
+
+    auto pid = ::fork();
+    if (pid < 0) {
+        std::cout << "Could not fork the consumer process!" << std::endl;
+        return 1;
+    }
+    if (pid == 0) {
+        ::_exit(consume(name, rows, cols, frames));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < frames; ++n) {
+        auto frame = makeFrame(rows, cols, n);
+        ring.publish(cvqoi::Encoder<>(frame));
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Published " << frames << " frames of " << cols << "x" << rows << " in " 
+              << elapsed.count() << " s" << std::endl;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cout << "Consumer failed!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
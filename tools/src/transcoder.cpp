@@ -0,0 +1,211 @@
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cvqoi/CVQoi.hpp"
+#include "cvqoi/BoundedQueue.hpp"
+
+namespace bfs = boost::filesystem;
+namespace bstrs = boost::iostreams;
+using Clock = std::chrono::steady_clock;
+
+// Converts every .png in a directory to .qoi with three overlapped stages connected by bounded
+// queues: read + PNG decode, QOI encode, write. Each stage has its own thread count.
+
+struct Decoded {
+    bfs::path output;
+    cv::Mat image;
+};
+
+struct Encoded {
+    bfs::path output;
+    std::vector<char> bytes;
+};
+
+struct StageStats {
+    std::string name;
+    size_t threads;
+    std::atomic<size_t> items{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<int64_t> busyNs{0};
+
+    void add(Clock::time_point begin, size_t byteCount) {
+        busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+        bytes += byteCount;
+        ++items;
+    }
+};
+
+template<typename F>
+std::vector<std::thread> runStage(size_t threads, F f) {
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; ++i) {
+        pool.emplace_back(f);
+    }
+    return pool;
+}
+
+void joinAll(std::vector<std::thread> &pool) {
+    for (auto &t : pool) {
+        t.join();
+    }
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 3) {
+        std::cout << "Usage: cvqoitranscoder <png dir> <output dir> [readers] [encoders] [writers] [queue depth]" << std::endl;
+        return 1;
+    }
+    bfs::path inputDir(argv[1]), outputDir(argv[2]);
+    // Every stage needs a thread, with none the queue in front of it fills up and the pipeline stalls.
+    auto arg = [&](int i, size_t def) {
+        auto value = argc > i ? static_cast<size_t>(std::stoul(argv[i])) : def;
+        if (value == 0) {
+            throw std::invalid_argument("zero");
+        }
+        return value;
+    };
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t readThreads, encodeThreads, writeThreads, depth;
+    try {
+        readThreads = arg(3, 2);
+        encodeThreads = arg(4, cores);
+        writeThreads = arg(5, 2);
+        depth = arg(6, 16);
+    }
+    catch (const std::logic_error &) {
+        std::cout << "Thread counts and queue depth must be positive numbers" << std::endl;
+        return 1;
+    }
+    StageStats read{"read", readThreads}, encode{"encode", encodeThreads}, write{"write", writeThreads};
+
+    std::vector<bfs::path> pngFiles;
+    try {
+        if (!bfs::is_directory(inputDir)) {
+            std::cout << inputDir << " is not a directory" << std::endl;
+            return 1;
+        }
+        for (auto &x : bfs::directory_iterator(inputDir)) {
+            if (x.path().extension() == ".png") {
+                pngFiles.push_back(x.path());
+            }
+        }
+        bfs::create_directories(outputDir);
+    }
+    catch (const bfs::filesystem_error &ex) {
+        std::cout << ex.what() << std::endl;
+        return 1;
+    }
+
+    cvqoi::BoundedQueue<Decoded> decodedQueue(depth);
+    cvqoi::BoundedQueue<Encoded> encodedQueue(depth);
+    std::atomic<size_t> nextFile{0}, failed{0};
+    // Stages report from several threads, one line at a time.
+    std::mutex logMutex;
+    auto fail = [&](const std::string &message) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout << message << std::endl;
+        ++failed;
+    };
+    auto start = Clock::now();
+
+    auto readers = runStage(read.threads, [&] {
+        for (size_t i = nextFile++; i < pngFiles.size(); i = nextFile++) {
+            auto begin = Clock::now();
+            auto name = pngFiles[i].filename().string();
+            Decoded d;
+            try {
+                d.output = outputDir / pngFiles[i].filename().replace_extension(".qoi");
+                d.image = cv::imread(pngFiles[i].string(), cv::IMREAD_UNCHANGED);
+            }
+            catch (const std::exception &ex) {
+                fail("Skipping " + name + ", " + ex.what());
+                continue;
+            }
+            if (d.image.empty() || d.image.depth() != CV_8U || (d.image.channels() != 3 && d.image.channels() != 4)) {
+                fail("Skipping " + name + ", only 8-bit BGR/A images are supported");
+                continue;
+            }
+            read.add(begin, d.image.total() * d.image.elemSize());
+            decodedQueue.push(std::move(d));
+        }
+    });
+    auto encoders = runStage(encode.threads, [&] {
+        Decoded d;
+        while (decodedQueue.pop(d)) {
+            auto begin = Clock::now();
+            Encoded e{std::move(d.output), {}};
+            try {
+                e.bytes.reserve(d.image.total() * d.image.elemSize() / 2);
+                bstrs::back_insert_device<std::vector<char>> sink{e.bytes};
+                bstrs::stream<bstrs::back_insert_device<std::vector<char>>> os{sink};
+                if (d.image.channels() == 4) {
+                    os << cvqoi::Encoder<true>(d.image);
+                }
+                else {
+                    os << cvqoi::Encoder<>(d.image);
+                }
+            }
+            catch (const std::exception &ex) {
+                fail("Could not encode " + e.output.string() + ", " + ex.what());
+                continue;
+            }
+            encode.add(begin, e.bytes.size());
+            encodedQueue.push(std::move(e));
+        }
+    });
+    auto writers = runStage(write.threads, [&] {
+        Encoded e;
+        while (encodedQueue.pop(e)) {
+            auto begin = Clock::now();
+            std::ofstream os(e.output.string(), std::ios::binary);
+            os.write(e.bytes.data(), e.bytes.size());
+            if (!os) {
+                fail("Could not write " + e.output.string());
+                continue;
+            }
+            write.add(begin, e.bytes.size());
+        }
+    });
+
+    joinAll(readers);
+    decodedQueue.close();
+    joinAll(encoders);
+    encodedQueue.close();
+    joinAll(writers);
+
+    std::chrono::duration<double> wall = Clock::now() - start;
+    std::cout << "Transcoded " << write.items << " of " << pngFiles.size() << " images in "
+              << wall.count() << " s (" << write.items / wall.count() << " images/s)" << std::endl;
+    // A stage's capacity is what its threads could do if they never waited on a queue,
+    // the one with the lowest capacity is the bottleneck.
+    const StageStats *bottleneck = nullptr;
+    double lowest = 0;
+    for (const auto *s : {&read, &encode, &write}) {
+        double busy = s->busyNs / 1e9;
+        double capacity = busy > 0 ? s->items * s->threads / busy : 0;
+        std::cout << std::left << std::setw(8) << s->name << s->threads << " threads, "
+                  << s->items << " images, " << s->bytes / 1e6 << " MB, busy " << busy << " s, "
+                  << "capacity " << capacity << " images/s" << std::endl;
+        if (busy > 0 && (!bottleneck || capacity < lowest)) {
+            bottleneck = s;
+            lowest = capacity;
+        }
+    }
+    if (bottleneck) {
+        std::cout << "Bottleneck: " << bottleneck->name << std::endl;
+    }
+    return failed > 0 ? 1 : 0;
+}